@@ -6,9 +6,13 @@
 #include <cstdint>
 #include <unordered_map>
 #include <unordered_set>
+#include <map>
 #include <regex>
 #include <iomanip>
 #include <format>
+#include <cstring>
+#include <array>
+#include <filesystem>
 
 using namespace std;
 using u32 = uint32_t;
@@ -39,14 +43,69 @@ struct Section
     string name;
     vector<char> data;
     vector<Relocation> rel;
+    u32 zero_fill = 0; // .skip bytes at the end not materialized yet
 };
 
-unordered_map<string, Symbol> symbols;
-unordered_map<string, Section> sections;
+// object format v3: header, section table, section data, relocation tables, symbol table, string table
+// every record has a fixed size and refers to names by their offset in the string table
+// the data of each section and every table start 4 byte aligned, so objects can be used in place
+constexpr char object_magic[4] = {'S', 'S', 'O', 'B'};
+constexpr u32 object_version = 3; // 3: sections carry their zero-fill length
+// header flag: relocation tables are byte streams sorted by offset, every relocation is a varint
+// offset delta, a varint target (0 absolute, then sections, then symbols) and a zigzag varint addend
+constexpr u32 object_packed_relocations = 1;
+struct ObjectHeader
+{
+    char magic[4];
+    u32 version;
+    u32 flags;
+    u32 num_sections;
+    u32 num_symbols;
+    u32 sections_offset;
+    u32 symbols_offset;
+    u32 strtab_offset;
+    u32 strtab_size;
+};
+struct SectionEntry
+{
+    u32 name;
+    u32 flags;
+    u32 data_offset;
+    u32 data_size;
+    u32 rel_offset;
+    u32 num_rel;
+    u32 zero_fill; // zero bytes after the data_size stored ones
+};
+struct SymbolEntry
+{
+    u32 name;
+    u32 value;
+    u32 section;
+    char type;
+    char padding[3];
+};
+
+// ordered by name, the object and the listing come out the same for the same source
+map<string, Symbol> symbols;
+map<string, Section> sections;
 Section* active_section = nullptr; // Optional<Section&> the generic version
 bool file_end = false;
+bool listing = true; // -no-listing skips the .txt companion
 string err_str;
 
+// the current location counter of a section
+u32 section_pos(const Section& sec)
+{
+    return sec.data.size() + sec.zero_fill;
+}
+
+// real bytes follow, pending .skip zeros have to be in data first
+void materialize(Section& sec)
+{
+    sec.data.resize(section_pos(sec));
+    sec.zero_fill = 0;
+}
+
 void ltrim(string_view& str)
 {
     str.remove_prefix(min(str.find_first_not_of(" "), str.size()));
@@ -200,6 +259,7 @@ void process_assembly_directive(string_view str)
             throw runtime_error(".word direktiva pre prve sekcije");
 
         str.remove_prefix(6);
+        materialize(*active_section);
         auto list = parse_list(str);
         for (auto& word : list)
         {
@@ -218,7 +278,8 @@ void process_assembly_directive(string_view str)
 
         str.remove_prefix(6);
         size_t size = stoull(string(str), nullptr, 0);
-        active_section->data.resize(active_section->data.size() + size, 0);
+        // zeros at the end of a section are only counted, objects store a section made only of them by size
+        active_section->zero_fill += size;
     } else if(str.starts_with(".equ "))
     {
         str.remove_prefix(5);
@@ -257,6 +318,7 @@ void process_assembly_directive(string_view str)
         if(regex_search(str.begin(), str.end(), match, re))
         {
             string ascii_str = match[1].str();
+            materialize(*active_section);
             active_section->data.insert(active_section->data.end(), ascii_str.begin(), ascii_str.end());
             active_section->data.insert(active_section->data.end(), 0);
         }
@@ -360,7 +422,7 @@ void process_instruction(string_view str)
         }
         if(sym.name.empty())
             sym.name = label;
-        sym.value = active_section->data.size();
+        sym.value = section_pos(*active_section);
         sym.section = active_section->name;
         sym.resolved = true;
         if(sym.dependent_symbols.size())
@@ -369,6 +431,7 @@ void process_instruction(string_view str)
 
     if(instr.empty())
         return;
+    materialize(*active_section);
 
     // remove ALL whitespace from operands
     operands.erase(remove_if(operands.begin(), operands.end(), ::isspace), operands.end());
@@ -1008,31 +1071,48 @@ void fix_rel()
     }
 }
 
-void dump(string_view filename)
+// the listing text of every byte value, "00 " to "FF "
+constexpr array<array<char, 3>, 256> hex_bytes = [] {
+    array<array<char, 3>, 256> table{};
+    const char digits[] = "0123456789ABCDEF";
+    for(int b = 0; b < 256; b++)
+        table[b] = {digits[b >> 4], digits[b & 15], ' '};
+    return table;
+}();
+
+// bytes as listed in the .txt file, a line break before every 16 bytes
+void append_hex_listing(string& out, const char* data, size_t size)
+{
+    size_t pos = out.size();
+    out.resize(pos + size * 3 + (size + 15) / 16);
+    char* p = out.data() + pos;
+    for(size_t i = 0; i < size; i++)
+    {
+        if(i % 16 == 0)
+            *p++ = '\n';
+        memcpy(p, hex_bytes[(unsigned char)data[i]].data(), 3);
+        p += 3;
+    }
+}
+
+void dump_listing(string_view filename)
 {
-    // open file, in binary mode
     string txtfilename = string(filename) + ".txt";
     ofstream txtfout(txtfilename);
 
     txtfout << "Sections:" << sections.size() << endl;
 
     for(auto& [name, sec] : sections)
-        txtfout << name << " " << sec.data.size() << endl;
+        txtfout << name << " " << section_pos(sec) << endl;
 
+    string text;
     for(auto& [name, sec] : sections)
     {
-        txtfout << "." << name << endl;
-        int i = 0;
-        
-        for(char c : sec.data)
-        {
-            if(i % 16 == 0)
-                txtfout << endl;
-            
-            txtfout << format("{:02X} ", c);
-            
-            i++;
-        }
+        text = "." + name + "\n";
+        append_hex_listing(text, sec.data.data(), sec.data.size());
+        if(sec.zero_fill)
+            text += (sec.data.empty() ? "" : "\n") + "zero-fill: "s + to_string(sec.zero_fill) + "\n";
+        txtfout.write(text.data(), text.size());
     }
     txtfout << endl;
     txtfout << dec;
@@ -1067,54 +1147,111 @@ void dump(string_view filename)
         txtfout << name << " " << sym.value << " " << sym.section << " " << type << endl;
     }
     txtfout.close();
+}
 
-    string binfilename = string(filename);
-    ofstream fout(binfilename, ios::binary);
+void put_varint(string& out, u32 value)
+{
+    while(value >= 0x80)
+    {
+        out += (char)(value | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
 
-    u32 num_sections = sections.size();
-    fout.write((char*)&num_sections, sizeof(num_sections));
-    // name length, name, data size, data
+void dump(string_view filename)
+{
+    if(listing)
+        dump_listing(filename);
+    else
+        filesystem::remove(string(filename) + ".txt"); // no stale listing next to a new object
+
+    // the string table starts with the empty name, each name is stored once
+    string strtab(1, '\0');
+    unordered_map<string, u32> name_offsets{{"", 0}};
+    auto name_offset = [&](const string& name) {
+        auto [it, inserted] = name_offsets.try_emplace(name, strtab.size());
+        if(inserted)
+        {
+            strtab += name;
+            strtab += '\0';
+        }
+        return it->second;
+    };
+    auto align = [](size_t size) { return (size + 3) & ~size_t(3); };
+
+    ObjectHeader header{};
+    memcpy(header.magic, object_magic, sizeof(object_magic));
+    header.version = object_version;
+    header.flags = object_packed_relocations;
+    header.num_sections = sections.size();
+    header.num_symbols = symbols.size();
+    header.sections_offset = sizeof(ObjectHeader);
+    size_t pos = header.sections_offset + sections.size() * sizeof(SectionEntry);
+
+    vector<SectionEntry> section_table;
     for(auto& [name, sec] : sections)
     {
-        u32 name_len = name.size();
-        fout.write((char*)&name_len, sizeof(name_len));
-        fout.write(name.c_str(), name_len);
-        u32 data_size = sec.data.size();
-        fout.write((char*)&data_size, sizeof(data_size));
-        fout.write(sec.data.data(), data_size);
-
-        u32 num_relocations = sec.rel.size();
-        fout.write((char*)&num_relocations, sizeof(num_relocations));
-        for(auto& rel : sec.rel)
+        // trailing .skip space is only a length, it takes no room in the object
+        SectionEntry entry{name_offset(name), 0, (u32)pos, (u32)sec.data.size(), 0, (u32)sec.rel.size(), sec.zero_fill};
+        pos = align(pos + sec.data.size());
+        section_table.push_back(entry);
+    }
+    // relocations name their target by index, sections first as the linker prefers them over symbols
+    unordered_map<string, u32> targets{{"", 0}};
+    u32 index = 1 + sections.size();
+    for(auto& [name, sym] : symbols)
+        targets.try_emplace(name, index++);
+    index = 1;
+    for(auto& [name, sec] : sections)
+        targets[name] = index++;
+    u32 rel_base = pos;
+    string relocations;
+    size_t i = 0;
+    for(auto& [name, sec] : sections)
+    {
+        section_table[i++].rel_offset = rel_base + relocations.size();
+        auto rel = sec.rel;
+        stable_sort(rel.begin(), rel.end(), [](auto& a, auto& b) { return a.offset < b.offset; });
+        u32 offset = 0;
+        for(auto& r : rel)
         {
-            u32 offset = rel.offset;
-            fout.write((char*)&offset, sizeof(offset));
-            u32 addend = rel.addend;
-            fout.write((char*)&addend, sizeof(addend));
-            u32 symbol_len = rel.symbol.size();
-            fout.write((char*)&symbol_len, sizeof(symbol_len));
-            fout.write(rel.symbol.c_str(), symbol_len);
+            put_varint(relocations, r.offset - offset);
+            put_varint(relocations, targets.at(r.symbol));
+            put_varint(relocations, (r.addend << 1) ^ (u32)((i32)r.addend >> 31));
+            offset = r.offset;
         }
     }
-    u32 num_symbols = symbols.size();
-    fout.write((char*)&num_symbols, sizeof(num_symbols));
-    // name length, name, value, section
+    pos = align(pos + relocations.size());
+
+    header.symbols_offset = pos;
+    vector<SymbolEntry> symbol_table;
     for(auto& [name, sym] : symbols)
     {
-        u32 name_len = name.size();
-        fout.write((char*)&name_len, sizeof(name_len));
-        fout.write(name.c_str(), name_len);
-        fout.write((char*)&sym.value, sizeof(sym.value));
-        u32 section_len = sym.section.size();
-        fout.write((char*)&section_len, sizeof(section_len));
-        fout.write(sym.section.c_str(), section_len);
         char type = 'l';
         if(sym.is_global)
             type = 'g';
         if(sym.is_extern)
             type = 'e';
-        fout.write(&type, 1);
+        symbol_table.push_back(SymbolEntry{name_offset(name), sym.value, name_offset(sym.section), type, {}});
     }
+    pos += symbol_table.size() * sizeof(SymbolEntry);
+    header.strtab_offset = pos;
+    header.strtab_size = strtab.size();
+
+    // the whole object is laid out in memory and written at once
+    vector<char> out(pos + strtab.size());
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + header.sections_offset, section_table.data(), section_table.size() * sizeof(SectionEntry));
+    i = 0;
+    for(auto& [name, sec] : sections)
+        memcpy(out.data() + section_table[i++].data_offset, sec.data.data(), sec.data.size());
+    memcpy(out.data() + rel_base, relocations.data(), relocations.size());
+    memcpy(out.data() + header.symbols_offset, symbol_table.data(), symbol_table.size() * sizeof(SymbolEntry));
+    memcpy(out.data() + header.strtab_offset, strtab.data(), strtab.size());
+
+    ofstream fout(string(filename), ios::binary);
+    fout.write(out.data(), out.size());
     fout.close();
 }
 
@@ -1132,6 +1269,11 @@ int main(int argc, char** argv)
             out_filename = string(argv[i+1]);
             i++; continue;
         }
+        if(argv[i] == "-no-listing"sv)
+        {
+            listing = false;
+            continue;
+        }
         in_filename = argv[i];
     }
     if(in_filename.empty())
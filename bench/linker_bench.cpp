@@ -0,0 +1,285 @@
+// synthetic linker benchmark
+// generates object files in the v2 object format and times linker -relocatable and -hex on them
+// usage: linker_bench [-linker=<path>] [-dir=<objects dir>] [-objects=<n>] [-sections=<n>] [-globals=<n>]
+//                     [-externs=<n>] [-relocations=<n>] [-section-size=<bytes>] [-seed=<n>]
+//                     [-runs=<n>] [-threads=<n>] [-csv=<results file>]
+// every object defines its globals in shared section names, references globals of other objects
+// through externs, so -hex links resolve fully, results are appended to the csv file for tracking
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <string_view>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <format>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+using u32 = uint32_t;
+using u64 = uint64_t;
+
+// object format v2, still read by the linker next to the current v3
+constexpr char object_magic[4] = {'S', 'S', 'O', 'B'};
+constexpr u32 object_version = 2;
+struct ObjectHeader
+{
+    char magic[4];
+    u32 version;
+    u32 flags;
+    u32 num_sections;
+    u32 num_symbols;
+    u32 sections_offset;
+    u32 symbols_offset;
+    u32 strtab_offset;
+    u32 strtab_size;
+};
+struct SectionEntry
+{
+    u32 name;
+    u32 flags;
+    u32 data_offset;
+    u32 data_size;
+    u32 rel_offset;
+    u32 num_rel;
+};
+struct RelocationEntry
+{
+    u32 offset;
+    u32 addend;
+    u32 symbol;
+};
+struct SymbolEntry
+{
+    u32 name;
+    u32 value;
+    u32 section;
+    char type;
+    char padding[3];
+};
+
+struct Config
+{
+    string linker = "./linker";
+    string dir = "bench_objects";
+    u32 objects = 1000;
+    u32 sections = 4;
+    u32 globals = 20;
+    u32 externs = 20;
+    u32 relocations = 50; // per section
+    u32 section_size = 256;
+    u32 seed = 1;
+    u32 runs = 3;
+    u32 threads = 1;
+    string csv;
+};
+
+string global_name(u32 object, u32 index)
+{
+    return format("g_{}_{}", object, index);
+}
+
+void write_object(const Config& cfg, u32 object, mt19937& rng)
+{
+    string strtab(1, '\0');
+    unordered_map<string, u32> name_offsets{{"", 0}};
+    auto name_offset = [&](const string& name) {
+        auto [it, inserted] = name_offsets.try_emplace(name, strtab.size());
+        if(inserted)
+        {
+            strtab += name;
+            strtab += '\0';
+        }
+        return it->second;
+    };
+    auto pick = [&](u32 n) { return uniform_int_distribution<u32>(0, n - 1)(rng); };
+    u32 words = max(cfg.section_size / 4, 1u);
+
+    vector<SymbolEntry> symbols;
+    for(u32 i = 0; i < cfg.globals; i++)
+        symbols.push_back(SymbolEntry{name_offset(global_name(object, i)), pick(words) * 4, name_offset(format("s{}", pick(cfg.sections))), 'g', {}});
+    vector<u32> externs;
+    unordered_set<string> extern_names;
+    for(u32 i = 0; i < cfg.externs and cfg.objects > 1 and cfg.globals; i++)
+    {
+        u32 other = pick(cfg.objects - 1);
+        other += other >= object; // never this object
+        string name = global_name(other, pick(cfg.globals));
+        if(not extern_names.insert(name).second)
+            continue;
+        externs.push_back(name_offset(name));
+        symbols.push_back(SymbolEntry{externs.back(), 0, 0, 'e', {}});
+    }
+
+    ObjectHeader header{};
+    memcpy(header.magic, object_magic, sizeof(object_magic));
+    header.version = object_version;
+    header.num_sections = cfg.sections;
+    header.num_symbols = symbols.size();
+    header.sections_offset = sizeof(ObjectHeader);
+    u32 pos = header.sections_offset + cfg.sections * sizeof(SectionEntry);
+    u32 data_size = words * 4;
+
+    vector<SectionEntry> section_table;
+    for(u32 s = 0; s < cfg.sections; s++)
+    {
+        section_table.push_back(SectionEntry{name_offset(format("s{}", s)), 0, pos, data_size, 0, cfg.relocations});
+        pos += data_size;
+    }
+    // relocations target externs, this object's globals or section names, at random word offsets
+    u32 rel_base = pos;
+    vector<RelocationEntry> relocations;
+    for(u32 s = 0; s < cfg.sections; s++)
+    {
+        section_table[s].rel_offset = rel_base + relocations.size() * sizeof(RelocationEntry);
+        for(u32 r = 0; r < cfg.relocations; r++)
+        {
+            u32 kind = pick(3);
+            u32 symbol;
+            if(kind == 0 and not externs.empty())
+                symbol = externs[pick(externs.size())];
+            else if(kind == 1 and cfg.globals)
+                symbol = symbols[pick(cfg.globals)].name;
+            else
+                symbol = name_offset(format("s{}", pick(cfg.sections)));
+            relocations.push_back(RelocationEntry{pick(words) * 4, pick(64) * 4, symbol});
+        }
+    }
+    pos += relocations.size() * sizeof(RelocationEntry);
+    header.symbols_offset = pos;
+    pos += symbols.size() * sizeof(SymbolEntry);
+    header.strtab_offset = pos;
+    header.strtab_size = strtab.size();
+
+    vector<char> out(pos + strtab.size());
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + header.sections_offset, section_table.data(), section_table.size() * sizeof(SectionEntry));
+    for(auto& entry : section_table)
+    {
+        for(u32 i = 0; i < data_size; i++)
+            out[entry.data_offset + i] = rng();
+    }
+    memcpy(out.data() + rel_base, relocations.data(), relocations.size() * sizeof(RelocationEntry));
+    memcpy(out.data() + header.symbols_offset, symbols.data(), symbols.size() * sizeof(SymbolEntry));
+    memcpy(out.data() + header.strtab_offset, strtab.data(), strtab.size());
+
+    ofstream fout(format("{}/obj{}.o", cfg.dir, object), ios::binary);
+    fout.write(out.data(), out.size());
+}
+
+struct RunResult
+{
+    double seconds;
+    long peak_rss_kb;
+    int status;
+};
+
+// runs the command with stdout discarded, peak rss comes from the child's rusage
+RunResult run(const vector<string>& args)
+{
+    auto start = chrono::steady_clock::now();
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        freopen("/dev/null", "w", stdout);
+        vector<char*> argv;
+        for(auto& arg : args)
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage usage{};
+    wait4(pid, &status, 0, &usage);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return RunResult{elapsed.count(), usage.ru_maxrss, status};
+}
+
+int main(int argc, char** argv)
+{
+    Config cfg;
+    for(int i = 1; i < argc; i++)
+    {
+        string_view arg = argv[i];
+        auto number = [&](string_view prefix, u32& value) {
+            if(not arg.starts_with(prefix))
+                return false;
+            value = stoul(string(arg.substr(prefix.size())), 0, 0);
+            return true;
+        };
+        if(arg.starts_with("-linker="))
+            cfg.linker = string(arg.substr(8));
+        else if(arg.starts_with("-dir="))
+            cfg.dir = string(arg.substr(5));
+        else if(arg.starts_with("-csv="))
+            cfg.csv = string(arg.substr(5));
+        else if(not (number("-objects=", cfg.objects) or number("-sections=", cfg.sections) or number("-globals=", cfg.globals)
+            or number("-externs=", cfg.externs) or number("-relocations=", cfg.relocations) or number("-section-size=", cfg.section_size)
+            or number("-seed=", cfg.seed) or number("-runs=", cfg.runs) or number("-threads=", cfg.threads)))
+        {
+            cout << "Unknown option: " << arg << endl;
+            return 1;
+        }
+    }
+    if(cfg.objects == 0 or cfg.sections == 0)
+    {
+        cout << "-objects and -sections must be positive" << endl;
+        return 1;
+    }
+
+    filesystem::create_directories(cfg.dir);
+    mt19937 rng(cfg.seed);
+    auto gen_start = chrono::steady_clock::now();
+    vector<string> objects;
+    for(u32 object = 0; object < cfg.objects; object++)
+    {
+        write_object(cfg, object, rng);
+        objects.push_back(format("{}/obj{}.o", cfg.dir, object));
+    }
+    chrono::duration<double> gen_time = chrono::steady_clock::now() - gen_start;
+    cout << format("Generated {} objects in {:.3f}s", cfg.objects, gen_time.count()) << endl;
+
+    string threads = format("-threads={}", cfg.threads);
+    vector<pair<string, vector<string>>> modes = {
+        {"relocatable", {cfg.linker, "-relocatable", threads, "-o", cfg.dir + "/out.o"}},
+        {"hex", {cfg.linker, "-hex", threads, "-o", cfg.dir + "/out.hex"}},
+    };
+    ofstream csv;
+    if(not cfg.csv.empty())
+    {
+        bool fresh = not filesystem::exists(cfg.csv);
+        csv.open(cfg.csv, ios::app);
+        if(fresh)
+            csv << "mode,objects,sections,globals,externs,relocations,section_size,threads,run,seconds,peak_rss_kb" << endl;
+    }
+
+    cout << format("{:<12}{:>6}{:>12}{:>16}", "mode", "run", "time[s]", "peak rss[KiB]") << endl;
+    for(auto& [mode, args] : modes)
+    {
+        args.insert(args.end(), objects.begin(), objects.end());
+        for(u32 r = 0; r < cfg.runs; r++)
+        {
+            RunResult result = run(args);
+            if(not WIFEXITED(result.status) or WEXITSTATUS(result.status) != 0)
+            {
+                cout << "Linker failed in " << mode << " mode" << endl;
+                return 1;
+            }
+            cout << format("{:<12}{:>6}{:>12.3f}{:>16}", mode, r, result.seconds, result.peak_rss_kb) << endl;
+            if(csv.is_open())
+                csv << format("{},{},{},{},{},{},{},{},{},{:.6f},{}", mode, cfg.objects, cfg.sections, cfg.globals, cfg.externs,
+                    cfg.relocations, cfg.section_size, cfg.threads, r, result.seconds, result.peak_rss_kb) << endl;
+        }
+    }
+    return 0;
+}
@@ -10,9 +10,13 @@
 #include <iomanip>
 #include <format>
 #include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
 
 #include <termios.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,6 +34,112 @@ using i64 = int64_t;
 
 std::vector<u8> memory;
 
+// fuzzing: pages written after the snapshot are tracked so only they need to be restored
+constexpr u32 page_bits = 12;
+constexpr u32 page_size = 1u << page_bits;
+constexpr u32 no_page = 0xFFFFFFFF;
+bool track_dirty = false;
+std::vector<u8> page_dirty;
+std::vector<u32> dirty_pages;
+std::vector<u32> saved_page_index; // page -> index into saved_pages, no_page if not saved yet
+std::vector<u8> saved_pages;
+
+bool fuzzing = false;
+std::vector<u8> fuzz_input;
+size_t fuzz_pos = 0;
+u64 illegal_instructions = 0;
+
+// timer device registers
+constexpr u32 tim_cfg_addr = 0xFFFFFF10;    // legacy period select, 500ms to 60s
+constexpr u32 tim_period_addr = 0xFFFFFF14; // period in microseconds, overrides tim_cfg if not 0
+constexpr u32 tim_ctrl_addr = 0xFFFFFF18;   // bit 0: one-shot compare mode
+constexpr u32 tim_count_addr = 0xFFFFFF1C;  // current time in microseconds, read only
+constexpr u32 tim_cmp_addr = 0xFFFFFF20;    // one-shot compare value, cleared when it fires
+
+// virtual time: the timer counts executed instructions instead of host wall time
+bool virtual_time = false;
+u64 instructions_per_us = 1;
+u64 instret = 0;
+auto emulation_start = chrono::steady_clock::now();
+
+bool timer_interrupt_pending = false;
+bool keyboard_interrupt_pending = false;
+u64 last_timer_intr_us = 0;
+
+// call stack profiler: every distinct call path is a node in a trie, the shadow stack holds the current path
+struct frame_node
+{
+    u32 parent;
+    u32 func;
+    u64 samples = 0;
+};
+struct shadow_frame
+{
+    u32 node;
+    u32 return_addr;
+};
+bool profiling = false;
+u64 profile_period = 1;
+u64 profile_countdown = 1;
+std::vector<frame_node> frame_nodes{{0, 0x40000000}}; // the root is the entry point
+std::unordered_map<u64, u32> frame_children;          // parent << 32 | func -> node
+std::vector<shadow_frame> shadow_stack{{0, 0}};
+
+// cache simulator: set-associative LRU levels fed with every guest fetch, load and store
+enum access_kind
+{
+    access_fetch,
+    access_load,
+    access_store
+};
+const char* access_kind_names[] = {"fetch", "load", "store"};
+struct cache_level
+{
+    u32 size;
+    u32 line_size;
+    u32 ways;
+    u32 line_bits;
+    u32 sets;
+    std::vector<u32> tags; // sets * ways entries, line number + 1, 0 for an empty way
+    std::vector<u64> last_use;
+    u64 clock = 0;
+    u64 accesses[3] = {};
+    u64 misses[3] = {};
+};
+struct cache_range
+{
+    string name;
+    u32 start;
+    u32 end;
+    u64 accesses[3] = {};
+    u64 misses[2][3] = {};
+};
+bool cache_sim = false;
+std::vector<cache_level> cache_levels;
+std::vector<cache_range> cache_ranges; // sorted by start
+
+// interrupt latency: from an interrupt becoming pending until it is taken, and from entry until iret
+struct irq_stats
+{
+    u64 pending_instret;
+    chrono::steady_clock::time_point pending_time;
+    std::vector<u64> latency_instr;
+    std::vector<double> latency_us;
+    std::vector<u64> handler_instr;
+    std::vector<double> handler_us;
+};
+struct irq_frame
+{
+    u32 cause;
+    u32 sp; // stack pointer after pc and psw were pushed, iret pops pc from here
+    u64 instret;
+    chrono::steady_clock::time_point time;
+};
+const char* irq_cause_names[] = {"", "illegal instruction", "timer", "keyboard", "software"};
+bool irq_latency = false;
+irq_stats irq_causes[5];
+std::vector<irq_frame> irq_frames;
+
 struct cpu
 {
     u32 gpr[16];
@@ -54,19 +164,326 @@ union instr
     instr_info info;
 };
 
+void mark_dirty(u32 page)
+{
+    if(page_dirty[page])
+        return;
+    page_dirty[page] = 1;
+    dirty_pages.push_back(page);
+    if(saved_page_index[page] == no_page)
+    {
+        // first write since the snapshot, keep the snapshot contents of the page
+        saved_page_index[page] = saved_pages.size() / page_size;
+        auto begin = memory.begin() + ((u64)page << page_bits);
+        saved_pages.insert(saved_pages.end(), begin, begin + page_size);
+    }
+}
+
+void write_mem(u32 addr, u32 value)
+{
+    if(track_dirty) [[unlikely]]
+    {
+        mark_dirty(addr >> page_bits);
+        mark_dirty((u32)(addr + 3) >> page_bits);
+    }
+    *(u32*)(memory.data() + addr) = value;
+}
+
+void profile_call(u32 func, u32 return_addr)
+{
+    u32 parent = shadow_stack.back().node;
+    auto [it, inserted] = frame_children.try_emplace((u64)parent << 32 | func, frame_nodes.size());
+    if(inserted)
+        frame_nodes.push_back(frame_node{parent, func});
+    shadow_stack.push_back(shadow_frame{it->second, return_addr});
+}
+
+void profile_return(u32 target)
+{
+    // unwind to the frame that returns to target, returns not matching any call are ignored
+    for(size_t i = shadow_stack.size() - 1; i > 0; i--)
+    {
+        if(shadow_stack[i].return_addr == target)
+        {
+            shadow_stack.resize(i);
+            return;
+        }
+    }
+}
+
+// symbols from the linker's .symmap, sorted by address
+struct map_symbol
+{
+    u32 address;
+    u32 size;
+    string name;
+};
+std::vector<map_symbol> map_symbols;
+
+bool load_symbol_map(const string& file_name)
+{
+    ifstream fin(file_name, ios::binary);
+    char magic[4];
+    u32 header[3]; // num_sections, num_symbols, string table size
+    if(not fin.read(magic, sizeof(magic)) or memcmp(magic, "SSYM", 4) != 0 or not fin.read((char*)header, sizeof(header)))
+        return false;
+    std::vector<u32> table(header[0] * 3 + header[1] * 4);
+    string strtab(header[2], '\0');
+    if(not fin.read((char*)table.data(), table.size() * sizeof(u32)) or not fin.read(strtab.data(), strtab.size()))
+        return false;
+    for(u32 i = 0; i < header[1]; i++)
+    {
+        u32* entry = &table[header[0] * 3 + i * 4];
+        if(entry[2] >= strtab.size())
+            return false;
+        map_symbols.push_back(map_symbol{entry[0], entry[1], string(strtab.c_str() + entry[2])});
+    }
+    return true;
+}
+
+const map_symbol* find_map_symbol(u32 addr)
+{
+    auto it = upper_bound(map_symbols.begin(), map_symbols.end(), addr, [](u32 addr, const map_symbol& sym) {
+        return addr < sym.address;
+    });
+    if(it == map_symbols.begin() or addr - prev(it)->address >= max(prev(it)->size, 1u))
+        return nullptr;
+    return &*prev(it);
+}
+
+string frame_name(u32 addr)
+{
+    const map_symbol* sym = find_map_symbol(addr);
+    if(not sym)
+        return format("{:#010x}", addr);
+    if(sym->address == addr)
+        return sym->name;
+    return format("{}+{:#x}", sym->name, addr - sym->address);
+}
+
+void dump_profile(const string& file_name)
+{
+    // folded stacks: frames from the root separated by ';', then the sample count
+    ofstream fout(file_name);
+    vector<u32> path;
+    for(u32 node = 0; node < frame_nodes.size(); node++)
+    {
+        if(not frame_nodes[node].samples)
+            continue;
+        path.clear();
+        for(u32 n = node; n != 0; n = frame_nodes[n].parent)
+            path.push_back(n);
+        fout << frame_name(frame_nodes[0].func);
+        for(auto it = path.rbegin(); it != path.rend(); it++)
+            fout << ';' << frame_name(frame_nodes[*it].func);
+        fout << ' ' << frame_nodes[node].samples << '\n';
+    }
+}
+
+// statistics are kept by cache_access, an access split over two lines still counts once
+bool cache_lookup(cache_level& level, u32 line)
+{
+    level.clock++;
+    u64 set = (line % level.sets) * level.ways;
+    u64 victim = set;
+    for(u64 way = set; way < set + level.ways; way++)
+    {
+        if(level.tags[way] == line + 1)
+        {
+            level.last_use[way] = level.clock;
+            return true;
+        }
+        if(level.last_use[way] < level.last_use[victim])
+            victim = way;
+    }
+    level.tags[victim] = line + 1;
+    level.last_use[victim] = level.clock;
+    return false;
+}
+
+void cache_access(u32 addr, access_kind kind)
+{
+    cache_range* range = nullptr;
+    auto it = upper_bound(cache_ranges.begin(), cache_ranges.end(), addr, [](u32 addr, const cache_range& r) {
+        return addr < r.start;
+    });
+    if(it != cache_ranges.begin() and addr < prev(it)->end)
+    {
+        range = &*prev(it);
+        range->accesses[kind]++;
+    }
+
+    // an unaligned access may touch two lines, it is one access that misses a level if either line does
+    bool missed[2] = {};
+    u32 first_line = addr >> cache_levels[0].line_bits;
+    u32 last_line = (u32)(addr + 3) >> cache_levels[0].line_bits;
+    for(u32 line = first_line; ; line++)
+    {
+        // lower levels are only consulted on a miss
+        for(size_t l = 0; l < cache_levels.size(); l++)
+        {
+            u32 level_line = ((u64)line << cache_levels[0].line_bits) >> cache_levels[l].line_bits;
+            if(cache_lookup(cache_levels[l], level_line))
+                break;
+            missed[l] = true;
+        }
+        if(line == last_line)
+            break;
+    }
+    for(size_t l = 0; l < cache_levels.size(); l++)
+    {
+        if(l > 0 and not missed[l - 1])
+            break;
+        cache_levels[l].accesses[kind]++;
+        if(not missed[l])
+            continue;
+        cache_levels[l].misses[kind]++;
+        if(range)
+            range->misses[l][kind]++;
+    }
+}
+
+u32 load(u32 addr)
+{
+    if(cache_sim) [[unlikely]]
+        cache_access(addr, access_load);
+    return *(u32*)(memory.data() + addr);
+}
+
+void store(u32 addr, u32 value)
+{
+    if(cache_sim) [[unlikely]]
+        cache_access(addr, access_store);
+    write_mem(addr, value);
+}
+
 void push(cpu& cpu, u32 value)
 {
     cpu.gpr[14] -= 4;
-    *(u32*)(memory.data() + cpu.gpr[14]) = value;
+    store(cpu.gpr[14], value);
 }
 
 u32 pop(cpu& cpu)
 {
-    u32 value = *(u32*)(memory.data() + cpu.gpr[14]);
+    u32 value = load(cpu.gpr[14]);
     cpu.gpr[14] += 4;
     return value;
 }
 
+bool parse_cache_level(const string& str, cache_level& level)
+{
+    // size,line_size,ways
+    smatch match;
+    if(not regex_match(str, match, regex("(\\w+),(\\w+),(\\w+)")))
+        return false;
+    level.size = stoul(match[1].str(), 0, 0);
+    level.line_size = stoul(match[2].str(), 0, 0);
+    level.ways = stoul(match[3].str(), 0, 0);
+    if(level.line_size < 4 or (level.line_size & (level.line_size - 1)) or level.ways == 0)
+        return false;
+    if(level.size == 0 or level.size % (level.line_size * level.ways))
+        return false;
+    level.line_bits = __builtin_ctz(level.line_size);
+    level.sets = level.size / (level.line_size * level.ways);
+    level.tags.assign((u64)level.sets * level.ways, 0);
+    level.last_use.assign((u64)level.sets * level.ways, 0);
+    return true;
+}
+
+void print_cache_report()
+{
+    cout << "Cache simulation:" << endl;
+    for(size_t l = 0; l < cache_levels.size(); l++)
+    {
+        auto& level = cache_levels[l];
+        cout << format("L{}: {} B, {} B lines, {}-way, {} sets", l + 1, level.size, level.line_size, level.ways, level.sets) << endl;
+        for(int kind = 0; kind < 3; kind++)
+        {
+            u64 accesses = level.accesses[kind];
+            u64 misses = level.misses[kind];
+            cout << format("  {:<6} {:>12} accesses {:>12} misses {:>7.2f}% hit rate", access_kind_names[kind], accesses, misses,
+                accesses ? 100.0 * (accesses - misses) / accesses : 0.0) << endl;
+        }
+    }
+    for(auto& range : cache_ranges)
+    {
+        cout << format("{} [{:#010x}, {:#010x}):", range.name, range.start, range.end) << endl;
+        for(int kind = 0; kind < 3; kind++)
+        {
+            if(not range.accesses[kind])
+                continue;
+            cout << format("  {:<6} {:>12} accesses", access_kind_names[kind], range.accesses[kind]);
+            for(size_t l = 0; l < cache_levels.size(); l++)
+                cout << format(" L{} {:>12} misses", l + 1, range.misses[l][kind]);
+            cout << endl;
+        }
+    }
+}
+
+void raise_irq(bool& pending, u32 cause)
+{
+    if(irq_latency and not pending)
+    {
+        irq_causes[cause].pending_instret = instret;
+        irq_causes[cause].pending_time = chrono::steady_clock::now();
+    }
+    pending = true;
+}
+
+void irq_return(u32 sp)
+{
+    // frames deeper than sp were left without an iret
+    while(not irq_frames.empty() and irq_frames.back().sp < sp)
+        irq_frames.pop_back();
+    if(irq_frames.empty() or irq_frames.back().sp != sp)
+        return;
+    auto& frame = irq_frames.back();
+    auto& stats = irq_causes[frame.cause];
+    stats.handler_instr.push_back(instret - frame.instret);
+    stats.handler_us.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - frame.time).count());
+    irq_frames.pop_back();
+}
+
+template<typename T>
+T percentile(const std::vector<T>& sorted, double p)
+{
+    return sorted[min((size_t)(p * sorted.size()), sorted.size() - 1)];
+}
+
+void print_irq_report()
+{
+    cout << "Interrupt latency:" << endl;
+    for(u32 cause = 1; cause < 5; cause++)
+    {
+        auto& stats = irq_causes[cause];
+        if(stats.handler_instr.empty() and stats.latency_instr.empty())
+            continue;
+        cout << irq_cause_names[cause] << ":" << endl;
+        auto print = [](const char* what, std::vector<u64> instr, std::vector<double> us) {
+            if(instr.empty())
+                return;
+            sort(instr.begin(), instr.end());
+            sort(us.begin(), us.end());
+            cout << format("  {} ({} samples)", what, instr.size()) << endl;
+            cout << format("    instructions: p50 {} p90 {} p99 {} max {}",
+                percentile(instr, 0.5), percentile(instr, 0.9), percentile(instr, 0.99), instr.back()) << endl;
+            cout << format("    host us:      p50 {:.1f} p90 {:.1f} p99 {:.1f} max {:.1f}",
+                percentile(us, 0.5), percentile(us, 0.9), percentile(us, 0.99), us.back()) << endl;
+            // power of two buckets of instruction counts
+            u64 buckets[65] = {};
+            for(u64 n : instr)
+                buckets[n ? 64 - __builtin_clzll(n) : 0]++;
+            for(int b = 0; b < 65; b++)
+            {
+                if(buckets[b])
+                    cout << format("    [{}, {}): {}", b ? 1ull << (b - 1) : 0, b ? (1ull << (b - 1)) * 2 : 1, buckets[b]) << endl;
+            }
+        };
+        print("pending to handler entry", stats.latency_instr, stats.latency_us);
+        print("handler entry to iret", stats.handler_instr, stats.handler_us);
+    }
+}
+
 void interrupt(cpu& cpu, u32 cause)
 {
     // push psw and pc to stack
@@ -76,11 +493,37 @@ void interrupt(cpu& cpu, u32 cause)
     cpu.csr[0] |= 4;
     cpu.csr[2] = cause;
     cpu.gpr[15] = cpu.csr[1];
+    if(cause == 1)
+        illegal_instructions++;
+    if(profiling)
+        profile_call(cpu.csr[1], *(u32*)(memory.data() + cpu.gpr[14]));
+    if(irq_latency)
+    {
+        auto now = chrono::steady_clock::now();
+        auto& stats = irq_causes[cause];
+        if(cause == 2 or cause == 3)
+        {
+            stats.latency_instr.push_back(instret - stats.pending_instret);
+            stats.latency_us.push_back(chrono::duration<double, micro>(now - stats.pending_time).count());
+        }
+        irq_frames.push_back(irq_frame{cause, cpu.gpr[14], instret, now});
+    }
 }
 
-auto getdur()
+u64 timer_now_us()
 {
-    u32 tim_cfg = *(u32*)(memory.data() + 0xFFFFFF10);
+    if(virtual_time)
+        return instret / instructions_per_us;
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - emulation_start).count();
+}
+
+chrono::microseconds getdur()
+{
+    u32 tim_period = *(u32*)(memory.data() + tim_period_addr);
+    if(tim_period)
+        return chrono::microseconds(tim_period);
+
+    u32 tim_cfg = *(u32*)(memory.data() + tim_cfg_addr);
     switch(tim_cfg)
     {
         case 0x0:
@@ -104,46 +547,43 @@ auto getdur()
     }
 }
 
-int main(int argc, char** argv)
+enum class stop_reason
 {
-    if (argc != 2)
-    {
-        cout << "Usage: emulator <input_file>" << endl;
-        return 1;
-    }
-
-    struct termios oldt, newt;
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
-
-    memory.resize(1ull << 32);
-
-    ifstream file(argv[1]);
-    if (!file.is_open())
-    {
-        cout << "Could not open file: " << argv[1] << endl;
-        return 1;
-    }
-
-    file.read((char*)memory.data(), (streamsize)memory.size());
-    file.close();
-
-    cpu cpu{};
-    cpu.gpr[15] = 0x40000000;
-    *(u32*)(memory.data() + 0xFFFFFF10) = 0x0; // timer config
+    halt,
+    budget,
+    breakpoint
+};
 
-    bool timer_interrupt_pending = false;
-    bool keyboard_interrupt_pending = false;
-    auto time_of_last_timer_intr_handling = chrono::steady_clock::now();
+int read_input()
+{
+    if(not fuzzing)
+        return getchar();
+    // deliver the fuzz input one byte at a time, each after the previous one was taken by the guest
+    if(keyboard_interrupt_pending or fuzz_pos == fuzz_input.size())
+        return EOF;
+    return fuzz_input[fuzz_pos++];
+}
 
+// runs until halt, until budget instructions are executed or until pc reaches breakpoint
+stop_reason run(cpu& cpu, u64 budget = ~0ull, u64 breakpoint = ~0ull)
+{
     bool running = true;
     while(running) [[likely]]
     {
+        if(cpu.gpr[15] == breakpoint) [[unlikely]]
+            return stop_reason::breakpoint;
+        if(budget-- == 0) [[unlikely]]
+            return stop_reason::budget;
+        instret++;
+        if(profiling and --profile_countdown == 0) [[unlikely]]
+        {
+            profile_countdown = profile_period;
+            frame_nodes[shadow_stack.back().node].samples++;
+        }
+
         //u32 instr = memory[cpu.gpr[15]];
+        if(cache_sim) [[unlikely]]
+            cache_access(cpu.gpr[15], access_fetch);
         u32 instruction = *(u32*)(memory.data() + cpu.gpr[15]);
         instr i;
         i.raw = instruction;
@@ -178,12 +618,14 @@ int main(int argc, char** argv)
                         break;
                     }
                     case 1:{
-                        cpu.gpr[15] = *(u32*)(memory.data() + tmp);
+                        cpu.gpr[15] = load(tmp);
                         break;
                     }
                     default:
                         interrupt(cpu, 1);
                 }
+                if(profiling and i.info.mode <= 1)
+                    profile_call(cpu.gpr[15], *(u32*)(memory.data() + cpu.gpr[14]));
                 break;
             }
             case 3:{
@@ -218,27 +660,27 @@ int main(int argc, char** argv)
                         break;
                     }
                     case 8:{
-                        cpu.gpr[15] = *(u32*)(memory.data() + tmp);
+                        cpu.gpr[15] = load(tmp);
                         break;
                     }
                     case 9:{
                         if (cpu.gpr[i.info.b] == cpu.gpr[i.info.c])
                         {
-                            cpu.gpr[15] = *(u32*)(memory.data() + tmp);
+                            cpu.gpr[15] = load(tmp);
                         }
                         break;
                     }
                     case 10:{
                         if (cpu.gpr[i.info.b] != cpu.gpr[i.info.c])
                         {
-                            cpu.gpr[15] = *(u32*)(memory.data() + tmp);
+                            cpu.gpr[15] = load(tmp);
                         }
                         break;
                     }
                     case 11:{
                         if ((i32)cpu.gpr[i.info.b] > (i32)cpu.gpr[i.info.c])
                         {
-                            cpu.gpr[15] = *(u32*)(memory.data() + tmp);
+                            cpu.gpr[15] = load(tmp);
                         }
                         break;
                     }
@@ -331,16 +773,16 @@ int main(int argc, char** argv)
                 switch (i.info.mode)
                 {
                     case 0:{
-                        *(u32*)(memory.data() + tmp) = cpu.gpr[i.info.c];
+                        store(tmp, cpu.gpr[i.info.c]);
                         break;
                     }
                     case 1:{
                         cpu.gpr[i.info.a] += D;
-                        *(u32*)(memory.data() + cpu.gpr[i.info.a]) = cpu.gpr[i.info.c];
+                        store(cpu.gpr[i.info.a], cpu.gpr[i.info.c]);
                         break;
                     }
                     case 2:{
-                        *(u32*)(memory.data() + *(u32*)(memory.data() + tmp)) = cpu.gpr[i.info.c];
+                        store(load(tmp), cpu.gpr[i.info.c]);
                         break;
                     }
                     default:
@@ -362,12 +804,17 @@ int main(int argc, char** argv)
                         break;
                     }
                     case 2:{
-                        cpu.gpr[i.info.a] = *(u32*)(memory.data() + tmp);
+                        cpu.gpr[i.info.a] = load(tmp);
                         break;
                     }
                     case 3:{
-                        cpu.gpr[i.info.a] = *(u32*)(memory.data() + cpu.gpr[i.info.b]);
+                        cpu.gpr[i.info.a] = load(cpu.gpr[i.info.b]);
                         cpu.gpr[i.info.b] += D;
+                        // pop pc is how ret and iret return
+                        if(profiling and i.info.a == 15)
+                            profile_return(cpu.gpr[15]);
+                        if(irq_latency and i.info.a == 15)
+                            irq_return(cpu.gpr[i.info.b] - D);
                         break;
                     }
                     case 4:{
@@ -379,11 +826,11 @@ int main(int argc, char** argv)
                         break;
                     }
                     case 6:{
-                        cpu.csr[i.info.a] = *(u32*)(memory.data() + tmp);
+                        cpu.csr[i.info.a] = load(tmp);
                         break;
                     }
                     case 7:{
-                        cpu.csr[i.info.a] = *(u32*)(memory.data() + cpu.gpr[i.info.b]);
+                        cpu.csr[i.info.a] = load(cpu.gpr[i.info.b]);
                         cpu.gpr[i.info.b] += D;
                         break;
                     }
@@ -397,23 +844,35 @@ int main(int argc, char** argv)
         }
 
         // interrupt handling
-        int ch = getchar();
+        int ch = read_input();
         if(ch != EOF)
         {
-            keyboard_interrupt_pending = true;
-            *(u32*)(memory.data() + 0xFFFFFF04) = ch;
+            raise_irq(keyboard_interrupt_pending, 3);
+            write_mem(0xFFFFFF04, ch);
         }
         ch = *(u32*)(memory.data() + 0xFFFFFF00);
         if(ch != EOF)
         {
-            putchar(ch);
-            *(u32*)(memory.data() + 0xFFFFFF00) = EOF;
+            if(not fuzzing)
+                putchar(ch);
+            write_mem(0xFFFFFF00, EOF);
         }
 
-        auto time_since_last_interrupt = chrono::steady_clock::now() - time_of_last_timer_intr_handling;
-        if(time_since_last_interrupt > getdur())
+        u64 now = timer_now_us();
+        write_mem(tim_count_addr, now);
+        if(*(u32*)(memory.data() + tim_ctrl_addr) & 1)
         {
-            timer_interrupt_pending = true;
+            // one-shot: fire once when the counter reaches the compare value, writing a new one rearms
+            u32 tim_cmp = *(u32*)(memory.data() + tim_cmp_addr);
+            if(tim_cmp and (i32)((u32)now - tim_cmp) >= 0)
+            {
+                raise_irq(timer_interrupt_pending, 2);
+                write_mem(tim_cmp_addr, 0);
+            }
+        }
+        else if(chrono::microseconds(now - last_timer_intr_us) > getdur())
+        {
+            raise_irq(timer_interrupt_pending, 2);
         }
         
         // check if interrupts are not masked
@@ -426,7 +885,7 @@ int main(int argc, char** argv)
                 {
                     interrupt(cpu, 2);
                     timer_interrupt_pending = false;
-                    time_of_last_timer_intr_handling = chrono::steady_clock::now();
+                    last_timer_intr_us = timer_now_us();
                 }
             }
             if(not (cpu.csr[0] & 2))
@@ -439,6 +898,288 @@ int main(int argc, char** argv)
             }
         }
     }
+    return stop_reason::halt;
+}
+
+void restore_dirty_pages()
+{
+    for(u32 page : dirty_pages)
+    {
+        auto saved = saved_pages.begin() + (u64)saved_page_index[page] * page_size;
+        copy(saved, saved + page_size, memory.begin() + ((u64)page << page_bits));
+        page_dirty[page] = 0;
+    }
+    dirty_pages.clear();
+}
+
+int fuzz(cpu& cpu, const string& corpus_dir, u64 fuzz_start, u64 budget)
+{
+    // run the guest initialization once, up to the marked point
+    if(fuzz_start != ~0ull and run(cpu, ~0ull, fuzz_start) != stop_reason::breakpoint)
+    {
+        cout << "Guest halted before reaching the fuzz start point" << endl;
+        return 1;
+    }
+
+    vector<string> inputs;
+    for(auto& entry : filesystem::directory_iterator(corpus_dir))
+    {
+        if(entry.is_regular_file())
+            inputs.push_back(entry.path().string());
+    }
+    sort(inputs.begin(), inputs.end());
+
+    // snapshot, from here on only pages the guest writes are saved and restored
+    const struct cpu snapshot = cpu;
+    const bool snapshot_timer_pending = timer_interrupt_pending;
+    const bool snapshot_keyboard_pending = keyboard_interrupt_pending;
+    const u64 snapshot_instret = instret;
+    const u64 snapshot_last_timer_intr_us = last_timer_intr_us;
+    page_dirty.assign(1u << (32 - page_bits), 0);
+    saved_page_index.assign(1u << (32 - page_bits), no_page);
+    track_dirty = true;
+
+    u64 halted = 0, timeouts = 0, crashes = 0;
+    auto start = chrono::steady_clock::now();
+    for(auto& input : inputs)
+    {
+        ifstream file(input, ios::binary);
+        fuzz_input.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        fuzz_pos = 0;
+        illegal_instructions = 0;
+
+        cpu = snapshot;
+        timer_interrupt_pending = snapshot_timer_pending;
+        keyboard_interrupt_pending = snapshot_keyboard_pending;
+        instret = snapshot_instret;
+        // in virtual time every run sees exactly the same timer, in wall time the period restarts
+        last_timer_intr_us = virtual_time ? snapshot_last_timer_intr_us : timer_now_us();
+
+        auto reason = run(cpu, budget);
+        if(illegal_instructions)
+        {
+            crashes++;
+            cout << "illegal instruction: " << input << endl;
+        }
+        else if(reason == stop_reason::budget)
+        {
+            timeouts++;
+            cout << "timeout: " << input << endl;
+        }
+        else
+            halted++;
+
+        restore_dirty_pages();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    cout << format("Fuzzed {} inputs in {:.3f}s ({:.0f} exec/s): {} halted, {} timed out, {} illegal instruction",
+        inputs.size(), elapsed.count(), inputs.size() / max(elapsed.count(), 1e-9), halted, timeouts, crashes) << endl;
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    string input_file;
+    string corpus_dir;
+    u64 fuzz_start = ~0ull;
+    u64 fuzz_budget = 1000000;
+    string profile_file;
+    string cache_l1, cache_l2;
+    std::vector<string> cache_range_symbols;
+    string symbols_file;
+    bool latency = false;
+    for(int i = 1; i < argc; i++)
+    {
+        string_view arg = argv[i];
+        if(arg.starts_with("-fuzz="))
+        {
+            corpus_dir = string(arg.substr(6));
+            continue;
+        }
+        if(arg.starts_with("-fuzz-start="))
+        {
+            fuzz_start = stoul(string(arg.substr(12)), 0, 0);
+            continue;
+        }
+        if(arg.starts_with("-fuzz-budget="))
+        {
+            fuzz_budget = stoull(string(arg.substr(13)), 0, 0);
+            continue;
+        }
+        if(arg.starts_with("-profile="))
+        {
+            profile_file = string(arg.substr(9));
+            continue;
+        }
+        if(arg.starts_with("-profile-period="))
+        {
+            // sample every n-th instruction
+            profile_period = max(stoull(string(arg.substr(16)), 0, 0), 1ull);
+            continue;
+        }
+        if(arg.starts_with("-cache-l1="))
+        {
+            cache_l1 = string(arg.substr(10));
+            continue;
+        }
+        if(arg.starts_with("-cache-l2="))
+        {
+            cache_l2 = string(arg.substr(10));
+            continue;
+        }
+        if(arg.starts_with("-cache-range="))
+        {
+            // -cache-range=name@start-end, or -cache-range=symbol with -symbols
+            smatch match;
+            string range(arg.substr(13));
+            if(range.find('@') == string::npos)
+            {
+                cache_range_symbols.push_back(range);
+                continue;
+            }
+            if(not regex_match(range, match, regex("(.+)@(\\w+)-(\\w+)")))
+            {
+                cout << "Invalid -cache-range argument: " << range << endl;
+                return 1;
+            }
+            cache_ranges.push_back(cache_range{match[1].str(), (u32)stoul(match[2].str(), 0, 0), (u32)stoul(match[3].str(), 0, 0)});
+            continue;
+        }
+        if(arg.starts_with("-symbols="))
+        {
+            symbols_file = string(arg.substr(9));
+            continue;
+        }
+        if(arg == "-irq-latency")
+        {
+            latency = true;
+            continue;
+        }
+        if(arg == "-virtual-time")
+        {
+            virtual_time = true;
+            continue;
+        }
+        if(arg.starts_with("-virtual-time="))
+        {
+            // instructions per simulated microsecond
+            virtual_time = true;
+            instructions_per_us = max(stoull(string(arg.substr(14)), 0, 0), 1ull);
+            continue;
+        }
+        input_file = arg;
+    }
+    if (input_file.empty())
+    {
+        cout << "Usage: emulator [-virtual-time[=<instr_per_us>]] [-profile=<out.folded> [-profile-period=<n>]] [-cache-l1=<size>,<line>,<ways> [-cache-l2=...] [-cache-range=<name>@<start>-<end>|<symbol>]] [-symbols=<file.symmap>] [-irq-latency] [-fuzz=<corpus_dir> [-fuzz-start=<addr>] [-fuzz-budget=<n>]] <input_file>" << endl;
+        return 1;
+    }
+    fuzzing = not corpus_dir.empty();
+    profiling = not profile_file.empty() and not fuzzing;
+    profile_countdown = profile_period;
+
+    if(not cache_l2.empty() and cache_l1.empty())
+    {
+        cout << "-cache-l2 requires -cache-l1" << endl;
+        return 1;
+    }
+    for(auto& config : {cache_l1, cache_l2})
+    {
+        if(config.empty())
+            continue;
+        cache_level level;
+        if(not parse_cache_level(config, level))
+        {
+            cout << "Invalid cache configuration: " << config << endl;
+            return 1;
+        }
+        cache_levels.push_back(std::move(level));
+    }
+    cache_sim = not cache_levels.empty() and not fuzzing;
+    irq_latency = latency and not fuzzing;
+    if(not symbols_file.empty() and not load_symbol_map(symbols_file))
+    {
+        cout << "Invalid symbol map: " << symbols_file << endl;
+        return 1;
+    }
+    for(auto& name : cache_range_symbols)
+    {
+        auto it = find_if(map_symbols.begin(), map_symbols.end(), [&](const map_symbol& sym) { return sym.name == name; });
+        if(it == map_symbols.end())
+        {
+            cout << "Unknown symbol in -cache-range: " << name << endl;
+            return 1;
+        }
+        cache_ranges.push_back(cache_range{name, it->address, it->address + it->size});
+    }
+    sort(cache_ranges.begin(), cache_ranges.end(), [](const cache_range& a, const cache_range& b) {
+        return a.start < b.start;
+    });
+    // every access is charged to at most one range
+    for(size_t i = 1; i < cache_ranges.size(); i++)
+    {
+        if(cache_ranges[i].start < cache_ranges[i - 1].end)
+        {
+            cout << "Overlapping -cache-range: " << cache_ranges[i - 1].name << " and " << cache_ranges[i].name << endl;
+            return 1;
+        }
+    }
+
+    struct termios oldt, newt;
+    tcgetattr(STDIN_FILENO, &oldt);
+    newt = oldt;
+    newt.c_lflag &= ~(ICANON | ECHO);
+    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+
+    memory.resize(1ull << 32);
+
+    int fd = open(input_file.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        cout << "Could not open file: " << input_file << endl;
+        return 1;
+    }
+
+    // images from the linker are sparse, only the extents holding data are read
+    off_t file_end = min<off_t>(lseek(fd, 0, SEEK_END), memory.size());
+    off_t data_start = lseek(fd, 0, SEEK_DATA);
+    if(data_start < 0 and errno != ENXIO)
+        data_start = 0; // no SEEK_DATA support, read everything
+    while(data_start >= 0 and data_start < file_end)
+    {
+        off_t data_end = lseek(fd, data_start, SEEK_HOLE);
+        if(data_end < 0 or data_end > file_end)
+            data_end = file_end;
+        while(data_start < data_end)
+        {
+            ssize_t n = pread(fd, memory.data() + data_start, data_end - data_start, data_start);
+            if(n <= 0)
+                break;
+            data_start += n;
+        }
+        data_start = lseek(fd, data_end, SEEK_DATA);
+    }
+    close(fd);
+
+    cpu cpu{};
+    cpu.gpr[15] = 0x40000000;
+    *(u32*)(memory.data() + tim_cfg_addr) = 0x0; // timer config
+    *(u32*)(memory.data() + tim_period_addr) = 0x0;
+    *(u32*)(memory.data() + tim_ctrl_addr) = 0x0;
+    *(u32*)(memory.data() + tim_cmp_addr) = 0x0;
+
+    emulation_start = chrono::steady_clock::now();
+
+    if(fuzzing)
+        return fuzz(cpu, corpus_dir, fuzz_start, fuzz_budget);
+
+    run(cpu);
+
+    if(profiling)
+        dump_profile(profile_file);
 
     cout << "Emulated processor executed halt instruction" << endl;
     cout << "Emulated processor state:" << endl;
@@ -451,6 +1192,11 @@ int main(int argc, char** argv)
         }
     }
 
+    if(cache_sim)
+        print_cache_report();
+    if(irq_latency)
+        print_irq_report();
+
     return 0;
 
 }
\ No newline at end of file
@@ -6,9 +6,25 @@
 #include <cstdint>
 #include <unordered_map>
 #include <unordered_set>
+#include <deque>
+#include <map>
+#include <algorithm>
 #include <regex>
 #include <iomanip>
 #include <format>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cstddef>
+#include <filesystem>
+#include <chrono>
+#include <new>
+#include <array>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 using u32 = uint32_t;
@@ -21,10 +37,11 @@ struct Placement
     string name;
     u32 start;
 };
+// names of symbols and sections are interned, everything refers to them by their dense id
 struct Symbol
 {
-    string name;
-    string section;
+    u32 name;
+    u32 section; // 0 (the empty name) if not in a section
     u32 value = 0;
     char type;
     bool resolved = false;
@@ -32,389 +49,2161 @@ struct Symbol
 struct Relocation
 {
     u32 addend;
-    string symbol;
+    u32 symbol; // may also be a section name
     u32 offset;
 };
 struct Section
 {
-    string name;
+    u32 name;
     vector<char> data;
     vector<Relocation> rel;
+    u32 bss = 0; // zero bytes after data, never materialized
 };
 struct ObjectFile
 {
-    unordered_map<string, Section> sections;
-    unordered_map<string, Symbol> symbols;
+    // ids in an object index its own name table until process_object maps them to global ids
+    vector<string> names;
+    vector<Section> sections;
+    vector<Symbol> symbols;
+    // filled by process_object: where each section landed in its combined section,
+    // and what was added to the addends of relocations against each section name
+    vector<u32> chunk_offsets;
+    vector<pair<u32, u32>> section_adjusts;
+};
+
+// object format v3, as written by the assembler: header, section table, section data,
+// relocation tables, symbol table, string table, names are offsets in the string table
+// v2 differs only in section entries without zero_fill, objects without the magic are read as the old length-prefixed v1 stream
+struct ObjectHeader
+{
+    char magic[4];
+    u32 version;
+    u32 flags;
+    u32 num_sections;
+    u32 num_symbols;
+    u32 sections_offset;
+    u32 symbols_offset;
+    u32 strtab_offset;
+    u32 strtab_size;
+};
+struct SectionEntry
+{
+    u32 name;
+    u32 flags;
+    u32 data_offset;
+    u32 data_size;
+    u32 rel_offset;
+    u32 num_rel;
+    u32 zero_fill; // zero bytes after the data_size stored ones, v3 only
+};
+struct RelocationEntry
+{
+    u32 offset;
+    u32 addend;
+    u32 symbol;
+};
+struct SymbolEntry
+{
+    u32 name;
+    u32 value;
+    u32 section;
+    char type;
+    char padding[3];
+};
+
+// a static library: member objects plus an index of the global symbols they define
+struct Archive
+{
+    const char* data = nullptr; // stays mapped until load_archive_members, members are parsed only when pulled in
+    size_t size = 0;
+    vector<string> member_names;
+    vector<pair<u32, u32>> members; // offset, size
+    unordered_map<string, u32> index; // global symbol -> member
+    vector<bool> loaded;
+};
+struct InputFile
+{
+    bool is_archive = false;
+    ObjectFile obj;
+    Archive archive;
+    u64 hash = 0;      // of the file contents, only computed for the link cache
+    u64 signature = 0; // of the object as read, only computed for the link cache
+};
+
+// the link cache remembers enough of a -hex link to patch changed objects into the output
+// as long as they keep their section sizes and non local symbols
+struct CachedSection
+{
+    string name;
+    u32 address;
+    u32 size;
+    u32 bss = 0; // of size, the trailing zero-fill part
+};
+struct CachedValue
+{
+    string name;
+    u32 value;
+};
+struct CachedInput
+{
+    string path;
+    u64 hash;
+    bool is_archive;
+    u64 signature;                     // of the section sizes and non local symbols
+    vector<CachedSection> sections;    // where this object's sections were placed
+    vector<CachedValue> section_adjusts;
+};
+struct LinkCache
+{
+    string options;
+    vector<CachedInput> inputs;
+    vector<CachedValue> symbols;       // final addresses of the global symbols
+    vector<CachedSection> sections;    // combined sections, sorted by address
+};
+
+constexpr u32 none = 0xFFFFFFFF;
+constexpr u32 entry_point = 0x40000000; // where the emulator starts executing
+constexpr char archive_magic[4] = {'S', 'S', 'A', 'R'};
+constexpr char symbol_map_magic[4] = {'S', 'S', 'Y', 'M'};
+constexpr char object_magic[4] = {'S', 'S', 'O', 'B'};
+constexpr u32 object_version = 3;
+constexpr u32 section_zero_fill = 1; // v2 section flag: data_size zero bytes, none stored
+// header flag: relocation tables are byte streams sorted by offset, every relocation is a varint
+// offset delta, a varint target (0 absolute, then sections, then symbols) and a zigzag varint addend
+constexpr u32 object_packed_relocations = 1;
+
+vector<InputFile> input_files;
+deque<string> names{""}; // id -> name, deque keeps the strings in place for name_ids
+unordered_map<string_view, u32> name_ids{{names[0], 0}};
+vector<u32> section_index{none}; // name id -> index in combined_sections
+vector<u32> symbol_index{none};  // name id -> index in combined_symbols
+vector<Section> combined_sections; // in order of first appearance
+vector<Symbol> combined_symbols;
+vector<Symbol> local_symbols; // only kept for the symbol map
+vector<u32> section_offsets; // final address by index in combined_sections, set by dump_hex
+bool link_cache_enabled = false;
+bool listing = true; // -no-listing skips the .txt companions
+string err_str;
+
+// -time-report: wall time, bytes allocated and item counts at the end of each phase
+struct PhaseStats
+{
+    string name;
+    double ms;
+    u64 allocated;
+    u64 objects;
+    u64 sections;
+    u64 symbols;
+    u64 relocations;
+};
+bool time_report = false;
+vector<PhaseStats> phases;
+atomic<u64> allocated_bytes = 0;
+chrono::steady_clock::time_point phase_start = chrono::steady_clock::now();
+u64 phase_allocated = 0;
+
+// only counts with -time-report, the flag is set before any worker thread starts
+// the array forms call these, every form allocates with malloc() and releases with free()
+// kept out of line, gcc warns on an inlined free() of memory from operator new
+[[gnu::noinline]] void* operator new(size_t size)
+{
+    if(time_report) [[unlikely]]
+        allocated_bytes.fetch_add(size, memory_order_relaxed);
+    if(void* p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new(size_t size, align_val_t align)
+{
+    if(time_report) [[unlikely]]
+        allocated_bytes.fetch_add(size, memory_order_relaxed);
+    // aligned_alloc wants a multiple of the alignment
+    size_t alignment = (size_t)align;
+    if(void* p = aligned_alloc(alignment, (max<size_t>(size, 1) + alignment - 1) & ~(alignment - 1)))
+        return p;
+    throw bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    try {
+        return operator new(size);
+    } catch(...) {
+        return nullptr;
+    }
+}
+
+[[gnu::noinline]] void* operator new(size_t size, align_val_t align, const nothrow_t&) noexcept
+{
+    try {
+        return operator new(size, align);
+    } catch(...) {
+        return nullptr;
+    }
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, align_val_t) noexcept
+{
+    free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, size_t, align_val_t) noexcept
+{
+    free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, const nothrow_t&) noexcept
+{
+    free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, align_val_t, const nothrow_t&) noexcept
+{
+    free(p);
+}
+
+// counts the combined state, or the parsed inputs before any of them were combined
+void end_phase(const string& name)
+{
+    if(not time_report)
+        return;
+    auto now = chrono::steady_clock::now();
+    u64 allocated = allocated_bytes.load();
+    PhaseStats stats{name, chrono::duration<double, milli>(now - phase_start).count(), allocated - phase_allocated, input_files.size(), 0, 0, 0};
+    if(combined_sections.empty() and combined_symbols.empty())
+    {
+        for(auto& input : input_files)
+        {
+            if(input.is_archive)
+                continue;
+            stats.sections += input.obj.sections.size();
+            stats.symbols += input.obj.symbols.size();
+            for(auto& sec : input.obj.sections)
+                stats.relocations += sec.rel.size();
+        }
+    }
+    else
+    {
+        stats.sections = combined_sections.size();
+        stats.symbols = combined_symbols.size() + local_symbols.size();
+        for(auto& sec : combined_sections)
+            stats.relocations += sec.rel.size();
+    }
+    phases.push_back(stats);
+    // the report itself is not measured
+    phase_start = chrono::steady_clock::now();
+    phase_allocated = allocated_bytes.load();
+}
+
+void print_time_report()
+{
+    if(not time_report)
+        return;
+    cout << format("{:<16}{:>12}{:>16}{:>10}{:>10}{:>10}{:>12}", "faza", "vreme[ms]", "alocirano[B]", "objekti", "sekcije", "simboli", "relokacije") << endl;
+    double total_ms = 0;
+    u64 total_allocated = 0;
+    for(auto& p : phases)
+    {
+        cout << format("{:<16}{:>12.3f}{:>16}{:>10}{:>10}{:>10}{:>12}", p.name, p.ms, p.allocated, p.objects, p.sections, p.symbols, p.relocations) << endl;
+        total_ms += p.ms;
+        total_allocated += p.allocated;
+    }
+    cout << format("{:<16}{:>12.3f}{:>16}", "ukupno", total_ms, total_allocated) << endl;
+}
+
+u32 intern(string_view name)
+{
+    auto it = name_ids.find(name);
+    if(it != name_ids.end())
+        return it->second;
+    u32 id = names.size();
+    names.emplace_back(name);
+    name_ids[names.back()] = id;
+    section_index.push_back(none);
+    symbol_index.push_back(none);
+    return id;
+}
+
+Section* find_section(u32 name)
+{
+    u32 idx = section_index[name];
+    return idx == none ? nullptr : &combined_sections[idx];
+}
+
+// references into combined_sections are invalidated when a new section is added
+u32 section_size(const Section& sec)
+{
+    return sec.data.size() + sec.bss;
+}
+
+// appends a chunk, zero-fill in front of real bytes has to be materialized
+void append_section(Section& sec, const Section& chunk)
+{
+    if(not chunk.data.empty())
+    {
+        sec.data.resize(section_size(sec));
+        sec.bss = 0;
+        sec.data.insert(sec.data.end(), chunk.data.begin(), chunk.data.end());
+    }
+    sec.bss += chunk.bss;
+}
+
+Section& combined_section(u32 name)
+{
+    if(section_index[name] == none)
+    {
+        section_index[name] = combined_sections.size();
+        combined_sections.push_back(Section{});
+        combined_sections.back().name = name;
+    }
+    return combined_sections[section_index[name]];
+}
+
+Symbol* find_symbol(u32 name)
+{
+    u32 idx = symbol_index[name];
+    return idx == none ? nullptr : &combined_symbols[idx];
+}
+
+Symbol& add_symbol(const Symbol& sym)
+{
+    symbol_index[sym.name] = combined_symbols.size();
+    combined_symbols.push_back(sym);
+    return combined_symbols.back();
+}
+
+// bounds checked cursor over the bytes of an object file
+struct ObjectReader
+{
+    const char* pos;
+    const char* end;
+    const string& filename;
+
+    void need(u64 n)
+    {
+        if(n > (u64)(end - pos))
+            throw runtime_error("Neispravan format fajla " + filename);
+    }
+    u32 read_u32()
+    {
+        need(sizeof(u32));
+        u32 value;
+        memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return value;
+    }
+    u64 read_u64()
+    {
+        u64 low = read_u32();
+        return low | (u64)read_u32() << 32;
+    }
+    char read_char()
+    {
+        need(1);
+        return *pos++;
+    }
+    string_view read_name()
+    {
+        u32 len = read_u32();
+        need(len);
+        string_view str(pos, len);
+        pos += len;
+        return str;
+    }
+    vector<char> read_bytes()
+    {
+        u32 len = read_u32();
+        need(len);
+        vector<char> bytes(pos, pos + len);
+        pos += len;
+        return bytes;
+    }
+};
+
+// fixed size records are used in place, only the names are interned
+ObjectFile parse_object_v2(const char* data, size_t size, const string& filename)
+{
+    auto fail = [&]() { throw runtime_error("Neispravan format fajla " + filename); };
+    auto check = [&](u64 offset, u64 count, u64 record_size) {
+        if(offset > size or count * record_size > size - offset)
+            fail();
+    };
+    ObjectHeader header;
+    check(0, 1, sizeof(header));
+    memcpy(&header, data, sizeof(header));
+    if((header.version != 2 and header.version != object_version) or (header.flags & ~object_packed_relocations))
+        throw runtime_error("Nepodrzana verzija objektnog fajla " + filename);
+    bool packed = header.flags & object_packed_relocations;
+    size_t entry_size = header.version == 2 ? offsetof(SectionEntry, zero_fill) : sizeof(SectionEntry);
+    check(header.sections_offset, header.num_sections, entry_size);
+    check(header.symbols_offset, header.num_symbols, sizeof(SymbolEntry));
+    check(header.strtab_offset, header.strtab_size, 1);
+    const char* strtab = data + header.strtab_offset;
+    if(header.strtab_size == 0 or strtab[header.strtab_size - 1] != '\0')
+        fail();
+
+    ObjectFile obj;
+    obj.names.push_back("");
+    unordered_map<u32, u32> ids; // string table offset -> local name id
+    auto name = [&](u32 offset) {
+        if(offset >= header.strtab_size)
+            fail();
+        if(strtab[offset] == '\0')
+            return 0u;
+        auto [it, inserted] = ids.try_emplace(offset, obj.names.size());
+        if(inserted)
+            obj.names.emplace_back(strtab + offset);
+        return it->second;
+    };
+
+    obj.sections.resize(header.num_sections);
+    for(u32 i = 0; i < header.num_sections; i++)
+    {
+        SectionEntry entry{};
+        memcpy(&entry, data + header.sections_offset + i * entry_size, entry_size);
+        if(header.version == 2 and (entry.flags & section_zero_fill))
+        {
+            entry.zero_fill = entry.data_size;
+            entry.data_size = 0;
+        }
+        if((u64)entry.data_size + entry.zero_fill > none)
+            fail();
+        check(entry.data_offset, entry.data_size, 1);
+        check(entry.rel_offset, entry.num_rel, packed ? 3 : sizeof(RelocationEntry));
+        auto& sec = obj.sections[i];
+        sec.name = name(entry.name);
+        sec.data.assign(data + entry.data_offset, data + entry.data_offset + entry.data_size);
+        sec.bss = entry.zero_fill;
+        sec.rel.resize(entry.num_rel);
+        if(packed)
+        {
+            const char* pos = data + entry.rel_offset;
+            auto varint = [&]() {
+                u32 value = 0;
+                for(u32 shift = 0; ; shift += 7)
+                {
+                    if(pos == data + size or shift > 28)
+                        fail();
+                    unsigned char byte = *pos++;
+                    value |= (u32)(byte & 0x7F) << shift;
+                    if(not (byte & 0x80))
+                        return value;
+                }
+            };
+            u32 offset = 0;
+            for(auto& rel : sec.rel)
+            {
+                offset += varint();
+                u32 target = varint();
+                u32 addend = varint();
+                u32 name_offset = 0;
+                if(target > header.num_sections + header.num_symbols)
+                    fail();
+                else if(target > header.num_sections)
+                    memcpy(&name_offset, data + header.symbols_offset + (target - header.num_sections - 1) * sizeof(SymbolEntry), sizeof(u32));
+                else if(target > 0)
+                    memcpy(&name_offset, data + header.sections_offset + (target - 1) * entry_size, sizeof(u32));
+                rel = Relocation{(addend >> 1) ^ -(addend & 1), name(name_offset), offset};
+            }
+            continue;
+        }
+        for(u32 r = 0; r < entry.num_rel; r++)
+        {
+            RelocationEntry rel;
+            memcpy(&rel, data + entry.rel_offset + r * sizeof(RelocationEntry), sizeof(rel));
+            sec.rel[r] = Relocation{rel.addend, name(rel.symbol), rel.offset};
+        }
+    }
+    obj.symbols.resize(header.num_symbols);
+    for(u32 i = 0; i < header.num_symbols; i++)
+    {
+        SymbolEntry entry;
+        memcpy(&entry, data + header.symbols_offset + i * sizeof(SymbolEntry), sizeof(entry));
+        obj.symbols[i] = Symbol{name(entry.name), name(entry.section), entry.value, entry.type};
+    }
+    return obj;
+}
+
+ObjectFile parse_object(const char* data, size_t size, const string& filename)
+{
+    if(size >= sizeof(object_magic) and memcmp(data, object_magic, sizeof(object_magic)) == 0)
+        return parse_object_v2(data, size, filename);
+
+    ObjectReader in{data, data + size, filename};
+    ObjectFile obj;
+    obj.names.push_back("");
+    unordered_map<string_view, u32> ids{{"", 0}};
+    auto read_name = [&]() {
+        auto [it, inserted] = ids.try_emplace(in.read_name(), obj.names.size());
+        if(inserted)
+            obj.names.emplace_back(it->first);
+        return it->second;
+    };
+
+    u32 num_sections = in.read_u32();
+    obj.sections.reserve(num_sections);
+    for(u32 i = 0; i < num_sections; i++)
+    {
+        Section sec;
+        sec.name = read_name();
+        sec.data = in.read_bytes();
+
+        u32 num_relocations = in.read_u32();
+        sec.rel.reserve(num_relocations);
+        for(u32 i = 0; i < num_relocations; i++)
+        {
+            Relocation rel;
+            rel.offset = in.read_u32();
+            rel.addend = in.read_u32();
+            rel.symbol = read_name();
+            sec.rel.push_back(rel);
+        }
+        obj.sections.push_back(std::move(sec));
+    }
+
+    u32 num_symbols = in.read_u32();
+    obj.symbols.reserve(num_symbols);
+    for(u32 i = 0; i < num_symbols; i++)
+    {
+        Symbol sym;
+        sym.name = read_name();
+        sym.value = in.read_u32();
+        sym.section = read_name();
+        sym.type = in.read_char();
+        obj.symbols.push_back(sym);
+    }
+    return obj;
+}
+
+pair<const char*, size_t> map_file(const string& filename)
+{
+    // the whole file is mapped and parsed from memory instead of many small reads
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw runtime_error("Ne mogu otvoriti fajl " + filename);
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = st.st_size;
+    void* data = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if(data == MAP_FAILED)
+        throw runtime_error("Ne mogu otvoriti fajl " + filename);
+    return {(const char*)data, size};
+}
+
+// the output file is sized up front and mapped, parts are then written directly into place
+struct OutputFile
+{
+    int fd;
+    char* data;
+    size_t size;
+};
+
+OutputFile create_output(const string& filename, size_t size)
+{
+    int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0 or ftruncate(fd, size) != 0) // gaps never written stay holes in a sparse file
+        throw runtime_error("Ne mogu otvoriti fajl " + filename);
+    void* data = size ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : nullptr;
+    if(data == MAP_FAILED)
+        throw runtime_error("Ne mogu otvoriti fajl " + filename);
+    return OutputFile{fd, (char*)data, size};
+}
+
+void close_output(OutputFile& out)
+{
+    if(out.size)
+        munmap(out.data, out.size);
+    close(out.fd);
+}
+
+// calls body(i) for every i < count on up to num_threads threads, including the calling one
+template<typename F>
+void parallel_for(size_t count, u32 num_threads, F&& body)
+{
+    atomic<size_t> next = 0;
+    auto worker = [&]() {
+        for(size_t i = next++; i < count; i = next++)
+            body(i);
+    };
+    vector<thread> threads;
+    for(u32 i = 1; i < min<size_t>(num_threads, count); i++)
+        threads.emplace_back(worker);
+    worker();
+    for(auto& t : threads)
+        t.join();
+}
+
+// the listing text of every byte value, "00 " to "FF "
+constexpr array<array<char, 3>, 256> hex_bytes = [] {
+    array<array<char, 3>, 256> table{};
+    const char digits[] = "0123456789ABCDEF";
+    for(int b = 0; b < 256; b++)
+        table[b] = {digits[b >> 4], digits[b & 15], ' '};
+    return table;
+}();
+
+// bytes as listed in the .txt files, a line break before every 16 bytes
+void append_hex_listing(string& out, const char* data, size_t size)
+{
+    size_t pos = out.size();
+    out.resize(pos + size * 3 + (size + 15) / 16);
+    char* p = out.data() + pos;
+    for(size_t i = 0; i < size; i++)
+    {
+        if(i % 16 == 0)
+            *p++ = '\n';
+        memcpy(p, hex_bytes[(unsigned char)data[i]].data(), 3);
+        p += 3;
+    }
+}
+
+// zero-fill at the end is only summed up, not listed byte by byte
+string section_listing(const string& name, u32 start, const char* data, size_t size, u32 bss = 0)
+{
+    string out = "Section: " + name + " start: " + to_string(start) + " length: " + to_string(size + bss) + "\n";
+    append_hex_listing(out, data, size);
+    out += '\n';
+    if(bss)
+        out += "zero-fill: " + to_string(bss) + "\n";
+    return out;
+}
+
+void write_section_listing(ofstream& txtfout, const string& name, u32 start, const char* data, size_t size, u32 bss = 0)
+{
+    string out = section_listing(name, start, data, size, bss);
+    txtfout.write(out.data(), out.size());
+}
+
+bool is_archive(const char* data, size_t size)
+{
+    return size >= sizeof(archive_magic) and memcmp(data, archive_magic, sizeof(archive_magic)) == 0;
+}
+
+Archive parse_archive(const char* data, size_t size, const string& filename)
+{
+    // magic, member count, (name, offset, size) per member, index entry count, (symbol, member) per entry
+    ObjectReader in{data + sizeof(archive_magic), data + size, filename};
+    Archive ar;
+    ar.data = data;
+    ar.size = size;
+    u32 num_members = in.read_u32();
+    for(u32 i = 0; i < num_members; i++)
+    {
+        ar.member_names.emplace_back(in.read_name());
+        u32 offset = in.read_u32();
+        u32 member_size = in.read_u32();
+        if((u64)offset + member_size > size)
+            throw runtime_error("Neispravan format fajla " + filename);
+        ar.members.push_back({offset, member_size});
+    }
+    u32 num_entries = in.read_u32();
+    for(u32 i = 0; i < num_entries; i++)
+    {
+        string_view symbol = in.read_name();
+        u32 member = in.read_u32();
+        if(member >= num_members)
+            throw runtime_error("Neispravan format fajla " + filename);
+        ar.index.emplace(symbol, member);
+    }
+    ar.loaded.resize(num_members);
+    return ar;
+}
+
+u64 fnv1a(const void* data, size_t size, u64 hash = 0xcbf29ce484222325)
+{
+    auto bytes = (const unsigned char*)data;
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    return hash;
+}
+
+u64 object_signature(const ObjectFile& obj)
+{
+    // everything other objects or the layout can observe, names are still the object's own
+    u64 hash = fnv1a(nullptr, 0);
+    auto add = [&](const void* data, size_t size) { hash = fnv1a(data, size, hash); };
+    auto add_name = [&](u32 name) {
+        u32 len = obj.names[name].size();
+        add(&len, sizeof(len));
+        add(obj.names[name].data(), len);
+    };
+    for(auto& sec : obj.sections)
+    {
+        add_name(sec.name);
+        u32 size = sec.data.size();
+        add(&size, sizeof(size));
+        add(&sec.bss, sizeof(sec.bss));
+    }
+    for(auto& sym : obj.symbols)
+    {
+        if(sym.type == 'l' and sym.section == 0)
+            continue; // local symbols in sections end up in the symbol map
+        add_name(sym.name);
+        add(&sym.value, sizeof(sym.value));
+        add_name(sym.section);
+        add(&sym.type, 1);
+    }
+    return hash;
+}
+
+InputFile read_input(const string& filename)
+{
+    auto [data, size] = map_file(filename);
+    InputFile input;
+    if(link_cache_enabled)
+        input.hash = fnv1a(data, size);
+    try {
+        if(is_archive(data, size))
+        {
+            input.is_archive = true;
+            input.archive = parse_archive(data, size, filename);
+            return input;
+        }
+        input.obj = parse_object(data, size, filename);
+        if(link_cache_enabled)
+            input.signature = object_signature(input.obj);
+    } catch(...) {
+        munmap((void*)data, size);
+        throw;
+    }
+    munmap((void*)data, size);
+    return input;
+}
+
+// parses all inputs on num_threads threads, the result keeps the command line order
+void read_objects(const vector<string>& filenames, u32 num_threads)
+{
+    input_files.resize(filenames.size());
+    vector<exception_ptr> errors(filenames.size());
+    parallel_for(filenames.size(), num_threads, [&](size_t i) {
+        try {
+            input_files[i] = read_input(filenames[i]);
+        } catch(...) {
+            errors[i] = current_exception();
+        }
+    });
+
+    // report the error of the first failing file, independent of scheduling
+    for(auto& error : errors)
+    {
+        if(error)
+            rethrow_exception(error);
+    }
+}
+
+void process_object(ObjectFile& obj)
+{
+    // map the object's names to global ids, each distinct name is hashed once per object
+    vector<u32> ids(obj.names.size());
+    for(u32 i = 0; i < obj.names.size(); i++)
+        ids[i] = intern(obj.names[i]);
+    for(auto& sym : obj.symbols)
+    {
+        sym.name = ids[sym.name];
+        sym.section = ids[sym.section];
+    }
+    for(auto& sec : obj.sections)
+    {
+        sec.name = ids[sec.name];
+        for(auto& rel : sec.rel)
+            rel.symbol = ids[rel.symbol];
+    }
+
+    // new sections are created in the order of the section table, not in the order symbols mention them
+    for(auto& sec : obj.sections)
+        combined_section(sec.name);
+
+    // first, global and local symbols with a section get the (running) lenght of that section from the combined_sections added to the value of the symbol
+    for(auto& sym : obj.symbols)
+    {
+        if(sym.section == 0)
+            continue;
+        if(sym.type == 'e')
+            continue;
+        
+        sym.value += section_size(combined_section(sym.section)); // fresh section is created if needed
+    }
+
+    // then, non local symbols get added to the combined_symbols
+    // globals as automatically resolved, error if multiple definitions
+    // extern as unresolved, accepts multiple definitions
+    for(auto& sym : obj.symbols)
+    {
+        if(sym.type == 'l')
+        {
+            if(sym.section != 0)
+                local_symbols.push_back(Symbol{sym.name, sym.section, sym.value, 'l', true});
+            continue;
+        }
+        
+        Symbol* csym = find_symbol(sym.name);
+        if(sym.type == 'g')
+        {
+            if(csym)
+            {
+                if(csym->resolved)
+                {
+                    if(csym->value != 0 or csym->section != 0) // workaround
+                    {
+                        err_str = "Simbol " + names[sym.name] + " je vec definisan";
+                        throw runtime_error(err_str);
+                    }
+                }
+                csym->value = sym.value;
+                csym->section = sym.section;
+                csym->resolved = true;
+            }
+            else
+            {
+                add_symbol(sym).resolved = true;
+            }
+        }
+        else
+        {
+            if(not csym) // extern symbol not yet defined
+                add_symbol(sym);
+        }
+    }
+    
+    // then, all sections are added to the combined_sections
+    for(auto& sec : obj.sections)
+    {
+        Section& combined_sec = combined_section(sec.name);
+
+        // todo: revisit this
+        for(auto& rel : sec.rel)
+        {
+            rel.offset += section_size(combined_sec);
+            if(Section* target = find_section(rel.symbol))
+            {
+                rel.addend += section_size(*target);
+                if(link_cache_enabled)
+                    obj.section_adjusts.push_back({rel.symbol, section_size(*target)});
+            }
+            combined_sec.rel.push_back(rel);
+        }
+    }
+
+    for(auto& sec : obj.sections)
+    {
+        Section& combined_sec = combined_section(sec.name);
+        obj.chunk_offsets.push_back(section_size(combined_sec));
+        append_section(combined_sec, sec);
+    }
+    if(link_cache_enabled)
+    {
+        sort(obj.section_adjusts.begin(), obj.section_adjusts.end());
+        obj.section_adjusts.erase(unique(obj.section_adjusts.begin(), obj.section_adjusts.end()), obj.section_adjusts.end());
+    }
+}
+
+
+void load_archive_members(Archive& ar, const string& filename)
+{
+    // pull in members defining currently undefined symbols, until the members pulled in need nothing more from this archive
+    // the archive is visited once, members are copied out when parsed so the mapping is released at the end
+    try {
+        bool changed = true;
+        while(changed)
+        {
+            changed = false;
+            for(size_t i = 0; i < combined_symbols.size(); i++)
+            {
+                if(combined_symbols[i].resolved)
+                    continue;
+                auto it = ar.index.find(names[combined_symbols[i].name]);
+                if(it == ar.index.end() or ar.loaded[it->second])
+                    continue;
+                u32 member = it->second;
+                ar.loaded[member] = true;
+                auto [offset, size] = ar.members[member];
+                ObjectFile obj = parse_object(ar.data + offset, size, filename + "(" + ar.member_names[member] + ")");
+                process_object(obj);
+                changed = true;
+            }
+        }
+    } catch(...) {
+        munmap((void*)ar.data, ar.size);
+        ar.data = nullptr;
+        throw;
+    }
+    munmap((void*)ar.data, ar.size);
+    ar.data = nullptr;
+}
+
+bool defines_symbol(const Symbol& sym)
+{
+    // same rule as the redefinition check, a global with no value and section is only declared
+    return sym.type == 'g' and (sym.value != 0 or sym.section != 0);
+}
+
+// the build id names an output by its content, later runs on identical inputs produce the same one
+void write_build_id(const string& file_name, u64 build_id)
+{
+    ofstream fout(file_name + ".buildid");
+    fout << format("{:016x}", build_id) << endl;
+}
+
+void dump_archive(const string& file_name, const vector<string>& filenames)
+{
+    vector<string> contents;
+    vector<pair<string, u32>> index;
+    unordered_set<string> indexed;
+    for(u32 i = 0; i < filenames.size(); i++)
+    {
+        auto& filename = filenames[i];
+        ifstream file(filename, ios::binary);
+        if(not file)
+        {
+            err_str = "Ne mogu otvoriti fajl " + filename;
+            throw runtime_error(err_str);
+        }
+        contents.emplace_back(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        auto& content = contents.back();
+        if(is_archive(content.data(), content.size()))
+        {
+            err_str = "Arhiva " + filename + " ne moze biti clan arhive";
+            throw runtime_error(err_str);
+        }
+        ObjectFile obj = parse_object(content.data(), content.size(), filename);
+        for(auto& sym : obj.symbols)
+        {
+            // the first member defining a symbol wins, like when linking loose objects in this order
+            if(defines_symbol(sym) and indexed.insert(obj.names[sym.name]).second)
+                index.push_back({obj.names[sym.name], i});
+        }
+    }
+
+    // members are stored after the header, so their offsets are known once the header size is
+    u64 header_size = sizeof(archive_magic) + 4 + 4;
+    for(auto& filename : filenames)
+        header_size += 4 + filesystem::path(filename).filename().string().size() + 8;
+    for(auto& [symbol, member] : index)
+        header_size += 4 + symbol.size() + 4;
+    // offsets and sizes are stored as 32 bits, checked before anything is written
+    vector<u32> member_offsets;
+    u64 offset = header_size;
+    for(u32 i = 0; i < filenames.size(); i++)
+    {
+        if(offset > none or contents[i].size() > none)
+        {
+            err_str = "Clan " + filenames[i] + " arhive " + file_name + " je iza granice od 4 GiB";
+            throw runtime_error(err_str);
+        }
+        member_offsets.push_back(offset);
+        offset += contents[i].size();
+    }
+
+    // the build id is the hash of the archive bytes, taken as they are written
+    ofstream fout(file_name, ios::binary);
+    u64 build_id = fnv1a(nullptr, 0);
+    auto write = [&](const void* data, size_t size) {
+        fout.write((const char*)data, size);
+        build_id = fnv1a(data, size, build_id);
+    };
+    write(archive_magic, sizeof(archive_magic));
+    u32 num_members = filenames.size();
+    write(&num_members, sizeof(num_members));
+    for(u32 i = 0; i < filenames.size(); i++)
+    {
+        string name = filesystem::path(filenames[i]).filename().string();
+        u32 name_len = name.size();
+        write(&name_len, sizeof(name_len));
+        write(name.c_str(), name_len);
+        u32 member_size = contents[i].size();
+        write(&member_offsets[i], sizeof(member_offsets[i]));
+        write(&member_size, sizeof(member_size));
+    }
+    u32 num_entries = index.size();
+    write(&num_entries, sizeof(num_entries));
+    for(auto& [symbol, member] : index)
+    {
+        u32 symbol_len = symbol.size();
+        write(&symbol_len, sizeof(symbol_len));
+        write(symbol.c_str(), symbol_len);
+        write(&member, sizeof(member));
+    }
+    for(auto& content : contents)
+        write(content.data(), content.size());
+    fout.close();
+    write_build_id(file_name, build_id);
+}
+
+void put_varint(string& out, u32 value)
+{
+    while(value >= 0x80)
+    {
+        out += (char)(value | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+// a relocation table in the packed form, rel is sorted by offset, targets maps a name id to its index
+string pack_relocations(const vector<Relocation>& rel, const vector<u32>& targets)
+{
+    string out;
+    u32 offset = 0;
+    for(auto& r : rel)
+    {
+        put_varint(out, r.offset - offset);
+        put_varint(out, targets[r.symbol]);
+        put_varint(out, (r.addend << 1) ^ (u32)((i32)r.addend >> 31));
+        offset = r.offset;
+    }
+    return out;
+}
+
+// an image is identified by its non empty sections in address order: address, size and bytes,
+// zeros at the end only count through the size, whether they were stored or zero-fill
+u64 hash_image_section(u64 hash, u32 address, u32 size, const char* data, size_t data_size)
+{
+    while(data_size and data[data_size - 1] == 0)
+        data_size--;
+    hash = fnv1a(&address, sizeof(address), hash);
+    hash = fnv1a(&size, sizeof(size), hash);
+    return fnv1a(data, data_size, hash);
+}
+
+void dump_relocatable(const string& file_name, u32 num_threads)
+{
+    // sections keep their layout order, everything else gets an order that does not depend
+    // on which object mentioned a symbol first or in which order relocations were emitted
+    sort(combined_symbols.begin(), combined_symbols.end(), [](const Symbol& a, const Symbol& b) {
+        return names[a.name] < names[b.name];
+    });
+    for(u32 idx = 0; idx < combined_symbols.size(); idx++)
+        symbol_index[combined_symbols[idx].name] = idx;
+    parallel_for(combined_sections.size(), num_threads, [&](size_t idx) {
+        auto& rel = combined_sections[idx].rel;
+        stable_sort(rel.begin(), rel.end(), [](const Relocation& a, const Relocation& b) { return a.offset < b.offset; });
+    });
+
+    if(listing)
+    {
+        ofstream txtfout(file_name + ".txt");
+        txtfout << "Sections:" << combined_sections.size() << endl;
+        for(auto& sec : combined_sections)
+            txtfout << names[sec.name] << " " << section_size(sec) << endl;
+        string text;
+        for(auto& sec : combined_sections)
+        {
+            text = "." + names[sec.name] + "\n";
+            append_hex_listing(text, sec.data.data(), sec.data.size());
+            if(sec.bss)
+                text += (sec.data.empty() ? "" : "\n") + "zero-fill: "s + to_string(sec.bss) + "\n";
+            txtfout.write(text.data(), text.size());
+        }
+        txtfout << endl;
+
+        for(auto& sec : combined_sections)
+        {
+            txtfout << "." << names[sec.name] << ".rel" << endl;
+            for(auto& rel : sec.rel)
+                txtfout << rel.offset << " " << names[rel.symbol] << " " << rel.addend << endl;
+        }
+        txtfout << "Symbols:" << combined_symbols.size() << endl;
+        for(auto& sym : combined_symbols)
+        {
+            char type = 'g';
+            if(not sym.resolved)
+                type = 'e';
+            txtfout << names[sym.name] << " " << sym.value << " " << names[sym.section] << " " << type << endl;
+        }
+        txtfout.close();
+    }
+    else
+        filesystem::remove(file_name + ".txt");
+    end_phase("listing");
+
+    // format v3, the same the assembler writes: header, section table, section data,
+    // relocation tables, symbol table, string table, everything is placed before writing
+    string strtab(1, '\0');
+    vector<u32> name_offsets(names.size(), none);
+    name_offsets[0] = 0;
+    auto name_offset = [&](u32 name) {
+        if(name_offsets[name] == none)
+        {
+            name_offsets[name] = strtab.size();
+            strtab += names[name];
+            strtab += '\0';
+        }
+        return name_offsets[name];
+    };
+    auto align = [](u64 size) { return (size + 3) & ~u64(3); };
+
+    ObjectHeader header{};
+    memcpy(header.magic, object_magic, sizeof(object_magic));
+    header.version = object_version;
+    header.flags = object_packed_relocations;
+    header.num_sections = combined_sections.size();
+    header.num_symbols = combined_symbols.size();
+    header.sections_offset = sizeof(ObjectHeader);
+    u64 pos = header.sections_offset + combined_sections.size() * sizeof(SectionEntry);
+    vector<SectionEntry> section_table;
+    for(auto& sec : combined_sections)
+    {
+        // only the real bytes are stored, the zero-fill after them is just a length
+        section_table.push_back(SectionEntry{name_offset(sec.name), 0, (u32)pos, (u32)sec.data.size(), 0, (u32)sec.rel.size(), sec.bss});
+        pos = align(pos + sec.data.size());
+    }
+    // relocation targets are indices, sections first as they take precedence over symbols with the same name
+    vector<u32> targets(names.size(), none);
+    targets[0] = 0;
+    for(size_t idx = combined_symbols.size(); idx-- > 0;)
+        targets[combined_symbols[idx].name] = 1 + combined_sections.size() + idx;
+    for(size_t idx = combined_sections.size(); idx-- > 0;)
+        targets[combined_sections[idx].name] = 1 + idx;
+    for(auto& sec : combined_sections)
+    {
+        for(auto& rel : sec.rel)
+        {
+            if(targets[rel.symbol] == none)
+            {
+                err_str = "Relokacija na simbol " + names[rel.symbol] + " koji nije u tabeli simbola";
+                throw runtime_error(err_str);
+            }
+        }
+    }
+    vector<string> rel_tables(combined_sections.size());
+    parallel_for(combined_sections.size(), num_threads, [&](size_t idx) {
+        rel_tables[idx] = pack_relocations(combined_sections[idx].rel, targets);
+    });
+    for(size_t idx = 0; idx < combined_sections.size(); idx++)
+    {
+        section_table[idx].rel_offset = pos;
+        pos += rel_tables[idx].size();
+    }
+    pos = align(pos);
+    header.symbols_offset = pos;
+    vector<SymbolEntry> symbol_table;
+    for(auto& sym : combined_symbols)
+        symbol_table.push_back(SymbolEntry{name_offset(sym.name), sym.value, name_offset(sym.section), sym.resolved ? 'g' : 'e', {}});
+    pos += symbol_table.size() * sizeof(SymbolEntry);
+    header.strtab_offset = pos;
+    header.strtab_size = strtab.size();
+    if(pos + strtab.size() > none)
+    {
+        err_str = "Izlazni fajl " + file_name + " je veci od 4 GiB";
+        throw runtime_error(err_str);
+    }
+
+    OutputFile out = create_output(file_name, pos + strtab.size());
+    memcpy(out.data, &header, sizeof(header));
+    memcpy(out.data + header.sections_offset, section_table.data(), section_table.size() * sizeof(SectionEntry));
+    // section payloads and relocation tables are independent, so sections are written on separate threads
+    parallel_for(combined_sections.size(), num_threads, [&](size_t idx) {
+        auto& sec = combined_sections[idx];
+        if(not sec.data.empty())
+            memcpy(out.data + section_table[idx].data_offset, sec.data.data(), sec.data.size());
+        memcpy(out.data + section_table[idx].rel_offset, rel_tables[idx].data(), rel_tables[idx].size());
+    });
+    memcpy(out.data + header.symbols_offset, symbol_table.data(), symbol_table.size() * sizeof(SymbolEntry));
+    memcpy(out.data + header.strtab_offset, strtab.data(), strtab.size());
+    write_build_id(file_name, fnv1a(out.data, out.size));
+    close_output(out);
+    end_phase("izlaz");
+}
+
+// drops the sections not reachable through relocations from the section at the entry point
+// and from the sections of the kept symbols, returns the names of the removed sections
+unordered_set<string> gc_sections(const vector<Placement>& placements, const vector<string>& keep)
+{
+    vector<u32> worklist;
+    vector<bool> reachable(combined_sections.size());
+    auto mark = [&](u32 idx) {
+        if(idx != none and not reachable[idx])
+        {
+            reachable[idx] = true;
+            worklist.push_back(idx);
+        }
+    };
+    for(auto& placement : placements)
+    {
+        auto it = name_ids.find(placement.name);
+        if(it == name_ids.end() or section_index[it->second] == none)
+            continue;
+        u32 idx = section_index[it->second];
+        if(placement.start <= entry_point and entry_point - placement.start < max(section_size(combined_sections[idx]), 1u))
+            mark(idx);
+    }
+    for(auto& name : keep)
+    {
+        auto it = name_ids.find(name);
+        Symbol* sym = it == name_ids.end() ? nullptr : find_symbol(it->second);
+        if(it != name_ids.end() and section_index[it->second] != none)
+            mark(section_index[it->second]); // a section name
+        else if(sym and sym->resolved)
+            mark(section_index[sym->section]);
+        else
+        {
+            err_str = "Simbol " + name + " iz -keep nije definisan";
+            throw runtime_error(err_str);
+        }
+    }
+    if(worklist.empty())
+    {
+        err_str = "-gc-sections bez sekcije na ulaznoj tacki i bez -keep simbola";
+        throw runtime_error(err_str);
+    }
+
+    while(not worklist.empty())
+    {
+        u32 idx = worklist.back();
+        worklist.pop_back();
+        for(auto& rel : combined_sections[idx].rel)
+        {
+            if(section_index[rel.symbol] != none)
+                mark(section_index[rel.symbol]);
+            else if(Symbol* sym = find_symbol(rel.symbol); sym and sym->resolved)
+                mark(section_index[sym->section]);
+        }
+    }
+
+    unordered_set<string> removed;
+    u64 removed_bytes = 0;
+    vector<Section> kept_sections;
+    for(u32 idx = 0; idx < combined_sections.size(); idx++)
+    {
+        auto& sec = combined_sections[idx];
+        if(reachable[idx])
+        {
+            section_index[sec.name] = kept_sections.size();
+            kept_sections.push_back(std::move(sec));
+            continue;
+        }
+        cout << "Uklonjena sekcija " << names[sec.name] << " (" << section_size(sec) << " B)" << endl;
+        removed.insert(names[sec.name]);
+        removed_bytes += section_size(sec);
+        section_index[sec.name] = none;
+    }
+    combined_sections = std::move(kept_sections);
+
+    // symbols defined in removed sections go with them
+    vector<Symbol> kept_symbols;
+    for(auto& sym : combined_symbols)
+    {
+        if(sym.resolved and sym.section != 0 and section_index[sym.section] == none)
+        {
+            symbol_index[sym.name] = none;
+            continue;
+        }
+        symbol_index[sym.name] = kept_symbols.size();
+        kept_symbols.push_back(sym);
+    }
+    combined_symbols = std::move(kept_symbols);
+    erase_if(local_symbols, [](const Symbol& sym) { return section_index[sym.section] == none; });
+
+    if(not removed.empty())
+        cout << "Uklonjeno " << removed.size() << " sekcija, " << removed_bytes << " B" << endl;
+    return removed;
+}
+
+// <file>.map lists section placements and symbols for people, <file>.symmap is the same for tools:
+// magic, num_sections, num_symbols, string table size,
+// sections (start, size, name offset), symbols sorted by address (address, size, name offset, section),
+// then the string table of zero terminated names
+void dump_symbol_map(const string& file_name)
+{
+    struct MapSymbol
+    {
+        u32 address;
+        u32 size;
+        u32 name;
+        u32 section; // index in combined_sections
+        char type;
+    };
+    vector<MapSymbol> map_symbols;
+    auto add = [&](const Symbol& sym) {
+        u32 idx = section_index[sym.section];
+        if(sym.resolved and idx != none)
+            map_symbols.push_back(MapSymbol{section_offsets[idx] + sym.value, 0, sym.name, idx, sym.type});
+    };
+    for(auto& sym : combined_symbols)
+        add(sym);
+    for(auto& sym : local_symbols)
+        add(sym);
+    sort(map_symbols.begin(), map_symbols.end(), [](const MapSymbol& a, const MapSymbol& b) {
+        return tie(a.address, a.section, a.name) < tie(b.address, b.section, b.name);
+    });
+    // a symbol spans up to the next higher address in its section, or the section end
+    for(size_t i = map_symbols.size(); i-- > 0;)
+    {
+        auto& sym = map_symbols[i];
+        u64 end = (u64)section_offsets[sym.section] + section_size(combined_sections[sym.section]);
+        for(size_t j = i + 1; j < map_symbols.size(); j++)
+        {
+            if(map_symbols[j].address == sym.address)
+                continue;
+            if(map_symbols[j].section == sym.section)
+                end = map_symbols[j].address;
+            break;
+        }
+        sym.size = end > sym.address ? end - sym.address : 0;
+    }
+
+    vector<u32> sorted_sections(combined_sections.size());
+    for(u32 idx = 0; idx < combined_sections.size(); idx++)
+        sorted_sections[idx] = idx;
+    stable_sort(sorted_sections.begin(), sorted_sections.end(), [](u32 a, u32 b) {
+        return section_offsets[a] < section_offsets[b];
+    });
+
+    ofstream txtfout(file_name + ".map");
+    txtfout << "Sections:" << endl;
+    for(u32 idx : sorted_sections)
+        txtfout << format("{:#010x} {:#010x} ", section_offsets[idx], section_size(combined_sections[idx])) << names[combined_sections[idx].name] << endl;
+    txtfout << "Symbols:" << endl;
+    for(auto& sym : map_symbols)
+        txtfout << format("{:#010x} {:#010x} {} ", sym.address, sym.size, sym.type) << names[sym.name] << " " << names[combined_sections[sym.section].name] << endl;
+    txtfout.close();
+
+    // each name is stored once in the string table
+    string strtab;
+    vector<u32> name_offsets(names.size(), none);
+    auto name_offset = [&](u32 name) {
+        if(name_offsets[name] == none)
+        {
+            name_offsets[name] = strtab.size();
+            strtab += names[name];
+            strtab += '\0';
+        }
+        return name_offsets[name];
+    };
+    vector<u32> table;
+    for(u32 idx = 0; idx < combined_sections.size(); idx++)
+    {
+        table.push_back(section_offsets[idx]);
+        table.push_back(section_size(combined_sections[idx]));
+        table.push_back(name_offset(combined_sections[idx].name));
+    }
+    for(auto& sym : map_symbols)
+    {
+        table.push_back(sym.address);
+        table.push_back(sym.size);
+        table.push_back(name_offset(sym.name));
+        table.push_back(sym.section);
+    }
+
+    ofstream fout(file_name + ".symmap", ios::binary);
+    u32 header[3] = {(u32)combined_sections.size(), (u32)map_symbols.size(), (u32)strtab.size()};
+    fout.write(symbol_map_magic, sizeof(symbol_map_magic));
+    fout.write((char*)header, sizeof(header));
+    fout.write((char*)table.data(), table.size() * sizeof(u32));
+    fout.write(strtab.data(), strtab.size());
+    fout.close();
+}
+
+// an -order file names hot symbols or sections, one per line, hottest first
+// a line may end with a weight, lines of emulator -profile folded stacks count for their last frame,
+// weights are summed per name and the heaviest come first, ties keep the order of the file
+vector<string> read_order_file(const string& filename)
+{
+    ifstream fin(filename);
+    if(not fin)
+        throw runtime_error("Ne mogu otvoriti fajl " + filename);
+    struct Entry
+    {
+        u32 first;
+        u64 weight;
+    };
+    vector<string> order;
+    unordered_map<string, Entry> entries;
+    string line;
+    smatch match;
+    while(getline(fin, line))
+    {
+        if(not regex_match(line, match, regex("\\s*([^#\\s][^\\s]*)(\\s+(\\d+))?\\s*")))
+            continue; // empty or a comment
+        string name = match[1].str();
+        if(auto pos = name.rfind(';'); pos != string::npos)
+            name = name.substr(pos + 1);
+        if(auto pos = name.find("+0x"); pos != string::npos)
+            name = name.substr(0, pos);
+        u64 weight = match[3].matched ? stoull(match[3].str()) : 0;
+        auto [it, inserted] = entries.try_emplace(name, Entry{(u32)order.size(), 0});
+        if(inserted)
+            order.push_back(name);
+        it->second.weight += weight;
+    }
+    stable_sort(order.begin(), order.end(), [&](const string& a, const string& b) {
+        return entries[a].weight > entries[b].weight;
+    });
+    return order;
+}
+
+// moves the sections of the named symbols and sections to the front in the given order,
+// the rest keep their input order, -place directives still take precedence
+void order_sections(const vector<string>& order)
+{
+    vector<u32> rank(combined_sections.size(), none);
+    unordered_map<u32, u32> local_sections; // profiles also name local labels
+    for(auto& local : local_symbols)
+        local_sections.try_emplace(local.name, local.section);
+    u32 missing = 0;
+    for(u32 r = 0; r < order.size(); r++)
+    {
+        auto it = name_ids.find(order[r]);
+        u32 idx = none;
+        if(it != name_ids.end() and section_index[it->second] != none)
+            idx = section_index[it->second];
+        else if(Symbol* sym = it == name_ids.end() ? nullptr : find_symbol(it->second); sym and sym->resolved)
+            idx = section_index[sym->section];
+        else if(it != name_ids.end() and local_sections.contains(it->second))
+            idx = section_index[local_sections[it->second]];
+        if(idx == none)
+            missing++;
+        else
+            rank[idx] = min(rank[idx], r);
+    }
+
+    vector<u32> layout(combined_sections.size());
+    for(u32 idx = 0; idx < layout.size(); idx++)
+        layout[idx] = idx;
+    stable_sort(layout.begin(), layout.end(), [&](u32 a, u32 b) { return rank[a] < rank[b]; });
+    vector<Section> sections;
+    sections.reserve(layout.size());
+    for(u32 idx : layout)
+    {
+        section_index[combined_sections[idx].name] = sections.size();
+        sections.push_back(std::move(combined_sections[idx]));
+    }
+    combined_sections = std::move(sections);
+    if(missing)
+        cout << missing << " imena iz -order nije pronadjeno" << endl;
+}
+
+// folds sections with identical contents and relocations into the first of them, symbols and
+// relocations are redirected to the survivor, placed sections keep their own copy
+// only sections named by -icf take part, the linker can not tell code and constants from data that is written
+// folding is repeated since sections referring to folded sections can become identical
+void fold_identical_sections(const vector<Placement>& placements, const vector<string>& foldable)
+{
+    unordered_set<u32> candidates_by_name;
+    u32 missing = 0;
+    for(auto& name : foldable)
+    {
+        auto it = name_ids.find(name);
+        if(it != name_ids.end() and section_index[it->second] != none)
+            candidates_by_name.insert(it->second);
+        else
+            missing++;
+    }
+    if(missing)
+        cout << missing << " sekcija iz -icf nije pronadjeno" << endl;
+    unordered_set<u32> placed;
+    for(auto& placement : placements)
+    {
+        auto it = name_ids.find(placement.name);
+        if(it != name_ids.end())
+            placed.insert(it->second);
+    }
+    unordered_map<u32, u32> folded_into; // folded section name -> survivor name
+    auto survivor = [&](u32 name) {
+        for(auto it = folded_into.find(name); it != folded_into.end(); it = folded_into.find(name))
+            name = it->second;
+        return name;
+    };
+
+    // relocations by offset with targets as surviving section + offset where known,
+    // a reference to the section itself compares equal to any other self reference
+    auto normalized = [&](const Section& sec) {
+        vector<Relocation> rels = sec.rel;
+        for(auto& rel : rels)
+        {
+            Symbol* sym = section_index[rel.symbol] == none ? find_symbol(rel.symbol) : nullptr;
+            if(sym and sym->resolved and sym->section != 0)
+            {
+                rel.addend += sym->value;
+                rel.symbol = sym->section;
+            }
+            rel.symbol = survivor(rel.symbol);
+            if(rel.symbol == sec.name)
+                rel.symbol = none;
+        }
+        sort(rels.begin(), rels.end(), [](const Relocation& a, const Relocation& b) {
+            return tie(a.offset, a.addend, a.symbol) < tie(b.offset, b.addend, b.symbol);
+        });
+        return rels;
+    };
+
+    u64 folded_sections = 0, folded_bytes = 0;
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        vector<vector<Relocation>> rels(combined_sections.size());
+        unordered_map<u64, vector<u32>> candidates; // content hash -> sections kept so far
+        for(u32 idx = 0; idx < combined_sections.size(); idx++)
+        {
+            auto& sec = combined_sections[idx];
+            // zero-fill is a buffer to be written, two of them are never the same memory
+            if(not candidates_by_name.contains(sec.name) or folded_into.contains(sec.name) or placed.contains(sec.name) or sec.data.empty() or sec.bss)
+                continue;
+            rels[idx] = normalized(sec);
+            u64 hash = fnv1a(sec.data.data(), sec.data.size());
+            for(auto& rel : rels[idx])
+                hash = fnv1a(&rel, sizeof(rel), hash);
+
+            auto& same_hash = candidates[hash];
+            auto it = find_if(same_hash.begin(), same_hash.end(), [&](u32 other) {
+                auto& a = rels[idx];
+                auto& b = rels[other];
+                return combined_sections[other].data == sec.data and equal(a.begin(), a.end(), b.begin(), b.end(), [](const Relocation& x, const Relocation& y) {
+                    return x.offset == y.offset and x.addend == y.addend and x.symbol == y.symbol;
+                });
+            });
+            if(it == same_hash.end())
+            {
+                same_hash.push_back(idx);
+                continue;
+            }
+            u32 target = combined_sections[*it].name;
+            folded_into[sec.name] = target;
+            cout << "Sekcija " << names[sec.name] << " spojena sa " << names[target] << " (" << section_size(sec) << " B)" << endl;
+            folded_sections++;
+            folded_bytes += section_size(sec);
+            changed = true;
+        }
+    }
+    if(folded_into.empty())
+        return;
+
+    for(auto* symbols : {&combined_symbols, &local_symbols})
+    {
+        for(auto& sym : *symbols)
+            sym.section = survivor(sym.section);
+    }
+    vector<Section> kept;
+    for(auto& sec : combined_sections)
+    {
+        if(folded_into.contains(sec.name))
+        {
+            section_index[sec.name] = none;
+            continue;
+        }
+        for(auto& rel : sec.rel)
+            rel.symbol = survivor(rel.symbol);
+        section_index[sec.name] = kept.size();
+        kept.push_back(std::move(sec));
+    }
+    combined_sections = std::move(kept);
+    cout << "Spojeno " << folded_sections << " sekcija, " << folded_bytes << " B" << endl;
+}
+
+// the assembler emits jmp/branches to symbols as: instr [pc+4] (D = 4), jmp pc+4, 32-bit literal
+// with the relocation on the literal, -relax rewrites them to a single direct instr with D = target - pc
+// calls keep the literal pool, their direct form adds gpr[B] and r0 is not hardwired to zero
+// only targets in the same section are relaxed, removing bytes never grows a distance inside a section
+// so a displacement that fits keeps fitting while other sites shrink, the rounds repeat until nothing changes
+struct RelaxedSite
+{
+    u32 instr; // offset of the instruction in its section
+    u32 target; // offset of the target in the same section
 };
 
-vector<ObjectFile> object_files;
-unordered_map<string, Section> combined_sections;
-unordered_map<string, Symbol> combined_symbols;
-string err_str;
+bool is_relaxable(const vector<char>& data, u32 instr)
+{
+    auto byte = [&](u32 i) { return (unsigned char)data[instr + i]; };
+    bool indirect_jmp = byte(0) >= 0x38 and byte(0) <= 0x3B; // jmp, beq, bne, bgt through memory
+    return indirect_jmp and byte(1) >> 4 == 15 and (byte(2) & 0x0F) == 0 and byte(3) == 4
+        and byte(4) == 0x30 and byte(5) == 0xF0 and byte(6) == 0x00 and byte(7) == 0x04;
+}
 
-ObjectFile& read_object(const string& filename)
+bool relax_section(u32 idx, vector<RelaxedSite>& sites)
 {
-    ifstream file(filename, ios::binary);
-    if(not file)
+    constexpr u32 removed_len = 8; // jmp pc+4 and the literal
+    auto& sec = combined_sections[idx];
+
+    // offsets something else refers to, no sequence containing one of them is touched
+    vector<u32> referenced;
+    auto add_symbols = [&](const vector<Symbol>& symbols) {
+        for(auto& sym : symbols)
+        {
+            if(sym.resolved and sym.section == sec.name)
+                referenced.push_back(sym.value);
+        }
+    };
+    add_symbols(combined_symbols);
+    add_symbols(local_symbols);
+    for(auto& other : combined_sections)
     {
-        err_str = "Ne mogu otvoriti fajl " + filename;
-        throw runtime_error(err_str);
+        for(auto& rel : other.rel)
+        {
+            if(rel.symbol == sec.name)
+                referenced.push_back(rel.addend);
+        }
     }
-    
-    ObjectFile obj;
+    for(auto& site : sites)
+        referenced.push_back(site.target);
+    sort(referenced.begin(), referenced.end());
 
-    u32 num_sections;
-    file.read((char*)&num_sections, sizeof(num_sections));
-    for(u32 i = 0; i < num_sections; i++)
+    vector<u32> removed; // start of each removed range, sorted
+    vector<bool> relaxed(sec.rel.size());
+    for(u32 r = 0; r < sec.rel.size(); r++)
     {
-        u32 name_len;
-        file.read((char*)&name_len, sizeof(name_len));
-        string name(name_len, '\0');
-        file.read(name.data(), name_len);
-        u32 data_size;
-        file.read((char*)&data_size, sizeof(data_size));
-        vector<char> data(data_size);
-        file.read(data.data(), data_size);
-        Section sec;
-        sec.name = name;
-        sec.data = data;
+        auto& rel = sec.rel[r];
+        if(rel.offset < 8 or (u64)rel.offset + 4 > sec.data.size() or not is_relaxable(sec.data, rel.offset - 8))
+            continue;
+        u32 target;
+        if(rel.symbol == sec.name)
+            target = rel.addend;
+        else if(Symbol* sym = find_symbol(rel.symbol); sym and sym->resolved and sym->section == sec.name)
+            target = sym->value + rel.addend;
+        else
+            continue;
+        u32 instr = rel.offset - 8;
+        i64 displacement = (i64)target - (instr + 4);
+        if(displacement < -2048 or displacement > 2047)
+            continue;
+        auto it = lower_bound(referenced.begin(), referenced.end(), instr + 4);
+        if(it != referenced.end() and *it < instr + 4 + removed_len)
+            continue;
+        if(not removed.empty() and removed.back() + removed_len > instr + 4)
+            continue;
+        removed.push_back(instr + 4);
+        relaxed[r] = true;
+        sites.push_back(RelaxedSite{instr, target});
+    }
+    if(removed.empty())
+        return false;
 
-        u32 num_relocations;
-        file.read((char*)&num_relocations, sizeof(num_relocations));
-        for(u32 i = 0; i < num_relocations; i++)
+    // an offset past a removed range moves back by its length
+    auto map_offset = [&](u32 offset) {
+        u32 count = upper_bound(removed.begin(), removed.end(), offset) - removed.begin();
+        if(count and offset < removed[count - 1] + removed_len)
+            count--; // inside or at the start of a removed range
+        return offset - count * removed_len;
+    };
+
+    vector<char> data;
+    data.reserve(sec.data.size() - removed.size() * removed_len);
+    u32 pos = 0;
+    for(u32 start : removed)
+    {
+        data.insert(data.end(), sec.data.begin() + pos, sec.data.begin() + start);
+        pos = start + removed_len;
+    }
+    data.insert(data.end(), sec.data.begin() + pos, sec.data.end());
+    sec.data = std::move(data);
+
+    vector<Relocation> rels;
+    for(u32 r = 0; r < sec.rel.size(); r++)
+    {
+        if(relaxed[r])
+            continue;
+        sec.rel[r].offset = map_offset(sec.rel[r].offset);
+        rels.push_back(sec.rel[r]);
+    }
+    sec.rel = std::move(rels);
+    for(auto& other : combined_sections)
+    {
+        for(auto& rel : other.rel)
         {
-            Relocation rel;
-            file.read((char*)&rel.offset, sizeof(rel.offset));
-            file.read((char*)&rel.addend, sizeof(rel.addend));
-            u32 symbol_len;
-            file.read((char*)&symbol_len, sizeof(symbol_len));
-            rel.symbol.resize(symbol_len);
-            file.read(rel.symbol.data(), symbol_len);
-            sec.rel.push_back(std::move(rel));
+            if(rel.symbol == sec.name)
+                rel.addend = map_offset(rel.addend);
+        }
+    }
+    for(auto* symbols : {&combined_symbols, &local_symbols})
+    {
+        for(auto& sym : *symbols)
+        {
+            if(sym.resolved and sym.section == sec.name)
+                sym.value = map_offset(sym.value);
         }
-        obj.sections[name] = std::move(sec);
     }
 
-    u32 num_symbols;
-    file.read((char*)&num_symbols, sizeof(num_symbols));
-    for(u32 i = 0; i < num_symbols; i++)
+    // every relaxed instruction, old ones included, gets its direct form and displacement again
+    for(auto& site : sites)
     {
-        u32 name_len;
-        file.read((char*)&name_len, sizeof(name_len));
-        string name(name_len, '\0');
-        file.read(name.data(), name_len);
-        u32 value;
-        file.read((char*)&value, sizeof(value));
-        u32 section_len;
-        file.read((char*)&section_len, sizeof(section_len));
-        string section(section_len, '\0');
-        file.read(section.data(), section_len);
-        char type;
-        file.read(&type, 1);
-        Symbol sym;
-        sym.name = name;
-        sym.section = std::move(section);
-        sym.value = value;
-        sym.type = type;
-        obj.symbols[name] = std::move(sym);
+        site.instr = map_offset(site.instr);
+        site.target = map_offset(site.target);
+        u32 displacement = site.target - (site.instr + 4);
+        char* instr = sec.data.data() + site.instr;
+        if((unsigned char)instr[0] >= 0x38)
+            instr[0] -= 8; // memory indirect to direct mode
+        instr[2] = (instr[2] & 0xF0) | ((displacement >> 8) & 0x0F);
+        instr[3] = displacement & 0xFF;
     }
-    object_files.push_back(std::move(obj));
+    return true;
+}
 
-    file.close();
-    return object_files.back();
+void relax()
+{
+    u64 before = 0, after = 0, relaxed = 0;
+    for(u32 idx = 0; idx < combined_sections.size(); idx++)
+    {
+        before += combined_sections[idx].data.size();
+        vector<RelaxedSite> sites;
+        while(relax_section(idx, sites))
+            ;
+        relaxed += sites.size();
+        after += combined_sections[idx].data.size();
+    }
+    if(relaxed)
+        cout << "Relaksirano " << relaxed << " skokova, usteda " << before - after << " B" << endl;
 }
 
-void process_object(ObjectFile& obj)
+void dump_hex(const string& file_name, const vector<Placement>& placements, u32 num_threads)
 {
-    // first, global and local symbols with a section get the (running) lenght of that section from the combined_sections added to the value of the symbol
-    for(auto& [name, sym] : obj.symbols)
+    // create the sections named by placements first, so the references below stay valid
+    vector<u32> placement_sections;
+    for(auto& placement : placements)
     {
-        if(sym.section.empty())
-            continue;
-        if(sym.type == 'e')
-            continue;
-        
-        sym.value += combined_sections[sym.section].data.size();
-        if(combined_sections[sym.section].name.empty())
-            combined_sections[sym.section].name = sym.section; // fresh section
+        u32 name = intern(placement.name);
+        combined_section(name);
+        placement_sections.push_back(section_index[name]);
     }
 
-    // then, non local symbols get added to the combined_symbols
-    // globals as automatically resolved, error if multiple definitions
-    // extern as unresolved, accepts multiple definitions
-    for(auto& [name, sym] : obj.symbols)
+    section_offsets.assign(combined_sections.size(), 0);
+    vector<bool> placed_sections(combined_sections.size());
+
+    // free address ranges, start -> end, placed sections are carved out of the whole 4 GiB space
+    constexpr u64 address_space = 1ull << 32;
+    map<u64, u64> gaps{{0, address_space}};
+    auto carve = [&](map<u64, u64>::iterator gap, u64 start, u64 end) {
+        u64 gap_start = gap->first, gap_end = gap->second;
+        gaps.erase(gap);
+        if(gap_start < start)
+            gaps[gap_start] = start;
+        if(end < gap_end)
+            gaps[end] = gap_end;
+    };
+
+    // first place sections in placements, they are sorted by start
+    // every placed range must lie in a single free range, otherwise it overlaps an earlier one
+    for(size_t i = 0; i < placements.size(); i++)
     {
-        if(sym.type == 'l')
+        auto& placement = placements[i];
+        u32 idx = placement_sections[i];
+        if(placed_sections[idx])
+        {
+            err_str = "Sekcija " + placement.name + " je navedena u vise -place direktiva";
+            throw runtime_error(err_str);
+        }
+        u64 start = placement.start;
+        u64 end = start + section_size(combined_sections[idx]);
+        if(end > address_space)
+        {
+            err_str = "Sekcija " + placement.name + " prelazi granicu od 4 GiB";
+            throw runtime_error(err_str);
+        }
+        section_offsets[idx] = start;
+        placed_sections[idx] = true;
+        if(start == end)
             continue;
-        
-        if(sym.type == 'g')
+
+        auto gap = gaps.upper_bound(start);
+        if(gap == gaps.begin() or prev(gap)->second < end)
         {
-            if(combined_symbols.contains(name))
+            // the previous non-empty placed section is the one overlapping
+            string other;
+            for(size_t j = i; j-- > 0;)
             {
-                if(combined_symbols[name].resolved)
+                u32 other_idx = placement_sections[j];
+                u32 other_size = section_size(combined_sections[other_idx]);
+                if(other_size and section_offsets[other_idx] + other_size > start)
                 {
-                    if(not combined_symbols[name].value == 0 or not combined_symbols[name].section.empty()) // workaround
-                    {
-                        err_str = "Simbol " + name + " je vec definisan";
-                        throw runtime_error(err_str);
-                    }
+                    other = placements[j].name;
+                    break;
                 }
-                auto &csym = combined_symbols[name];
-                csym.value = sym.value;
-                csym.section = sym.section;
-                csym.resolved = true;
-            }
-            else
-            {
-                combined_symbols[name] = sym;
-                combined_symbols[name].resolved = true;
             }
+            err_str = "Sekcije " + other + " i " + placement.name + " se preklapaju zbog -place direktiva";
+            throw runtime_error(err_str);
         }
-        else
+        carve(prev(gap), start, end);
+    }
+    // then place the rest of the sections, in layout order, each at the start of the first gap it fits in
+    for(u32 idx = 0; idx < combined_sections.size(); idx++)
+    {
+        if(placed_sections[idx])
+            continue;
+        u64 size = section_size(combined_sections[idx]);
+        auto gap = find_if(gaps.begin(), gaps.end(), [&](const pair<const u64, u64>& g) { return g.second - g.first >= size; });
+        if(gap == gaps.end())
         {
-            if(combined_symbols[name].name.empty()) // extern symbol not yet defined
-                combined_symbols[name] = sym;
+            err_str = "Nema mesta za sekciju " + names[combined_sections[idx].name] + " (" + to_string(size) + " B)";
+            throw runtime_error(err_str);
         }
+        section_offsets[idx] = gap->first;
+        if(size)
+            carve(gap, gap->first, gap->first + size);
     }
     
-    // then, all sections are added to the combined_sections
-    for(auto& [name, sec] : obj.sections)
+    end_phase("raspored");
+
+    // resolve every name to its final address once, section names take precedence over symbols
+    // a relocation writes that address + addend at section location + offset
+    vector<u32> addresses(names.size(), 0);
+    vector<bool> defined(names.size(), false);
+    defined[0] = true; // absolute
+    for(auto& symbol : combined_symbols)
+    {
+        if(not symbol.resolved)
+            continue;
+        u32 sec_idx = section_index[symbol.section];
+        addresses[symbol.name] = symbol.value + (sec_idx == none ? 0 : section_offsets[sec_idx]);
+        defined[symbol.name] = true;
+    }
+    for(u32 idx = 0; idx < combined_sections.size(); idx++)
     {
-        Section& combined_sec = combined_sections[name];
+        addresses[combined_sections[idx].name] = section_offsets[idx];
+        defined[combined_sections[idx].name] = true;
+    }
 
-        if(combined_sec.name.empty())
-            combined_sec.name = name;
-        // todo: revisit this
+    // then apply relocations in place, sections are independent so they are split between threads
+    // each section keeps its first error, the first one in section order is reported
+    vector<string> errors(combined_sections.size());
+    parallel_for(combined_sections.size(), num_threads, [&](size_t idx) {
+        auto& sec = combined_sections[idx];
         for(auto& rel : sec.rel)
         {
-            rel.offset += combined_sec.data.size();
-            if(combined_sections.find(rel.symbol) != combined_sections.end())
+            if((u64)rel.offset + 4 > sec.data.size())
             {
-                rel.addend += combined_sections[rel.symbol].data.size();
+                errors[idx] = "Relokacija van sekcije " + names[sec.name];
+                break;
             }
-            combined_sec.rel.push_back(std::move(rel));
+            if(not defined[rel.symbol])
+            {
+                errors[idx] = "Simbol " + names[rel.symbol] + " nije definisan";
+                break;
+            }
+            u32 value = addresses[rel.symbol] + rel.addend;
+            memcpy(sec.data.data() + rel.offset, &value, 4);
+        }
+    });
+    for(auto& error : errors)
+    {
+        if(not error.empty())
+        {
+            err_str = error;
+            throw runtime_error(err_str);
         }
     }
+    end_phase("relokacije");
+
+    // the listing and the build id go through the sections in address order
+    vector<pair<u32, u32>> sorted_offsets; // section index, start
+    for(u32 idx = 0; idx < combined_sections.size(); idx++)
+        sorted_offsets.push_back({idx, section_offsets[idx]});
+    stable_sort(sorted_offsets.begin(), sorted_offsets.end(), [](const pair<u32, u32>& a, const pair<u32, u32>& b) {
+        return a.second < b.second;
+    });
+
+    if(listing)
+    {
+        // When dumping the text representation, dump only memory that is a part of a section
+        // format: Section: name start: start length: length then hex data
+
+        // sections are formatted on separate threads, then written in address order
+        vector<string> listings(sorted_offsets.size());
+        parallel_for(sorted_offsets.size(), num_threads, [&](size_t i) {
+            auto [idx, start] = sorted_offsets[i];
+            auto& sec = combined_sections[idx];
+            listings[i] = section_listing(names[sec.name], start, sec.data.data(), sec.data.size(), sec.bss);
+        });
+        ofstream txtfout(file_name + ".txt");
+        for(auto& text : listings)
+            txtfout.write(text.data(), text.size());
+        txtfout.close();
+    }
+    else
+        filesystem::remove(file_name + ".txt"); // no stale listing next to a new image
+    end_phase("listing");
 
-    for(auto& [name, sec] : obj.sections)
+    // only the sections are written, the gaps stay holes in a sparse file that read back as zeros
+    // the file ends with the last section
+    u64 file_size = 0;
+    for(u32 idx = 0; idx < combined_sections.size(); idx++)
     {
-        Section& combined_sec = combined_sections[name];
-        combined_sec.data.insert(combined_sec.data.end(), sec.data.begin(), sec.data.end());
+        if(not combined_sections[idx].data.empty())
+            file_size = max<u64>(file_size, section_offsets[idx] + combined_sections[idx].data.size());
     }
+    OutputFile out = create_output(file_name, file_size);
+    parallel_for(combined_sections.size(), num_threads, [&](size_t idx) {
+        auto& sec = combined_sections[idx];
+        if(not sec.data.empty())
+            memcpy(out.data + section_offsets[idx], sec.data.data(), sec.data.size());
+    });
+    close_output(out);
+    u64 build_id = fnv1a(nullptr, 0);
+    for(auto [idx, start] : sorted_offsets)
+    {
+        auto& sec = combined_sections[idx];
+        if(section_size(sec))
+            build_id = hash_image_section(build_id, start, section_size(sec), sec.data.data(), sec.data.size());
+    }
+    write_build_id(file_name, build_id);
+    end_phase("izlaz");
+
+    dump_symbol_map(file_name);
+    end_phase("mapa simbola");
 }
 
-void dump_relocatable(const string& file_name)
+void write_u32(ofstream& fout, u32 value)
 {
-    string txtfilename = file_name + ".txt";
-    ofstream txtfout(txtfilename);
+    fout.write((char*)&value, sizeof(value));
+}
 
-    txtfout << "Sections:" << combined_sections.size() << endl;
-    for(auto section : combined_sections)
-    {
-        auto& [name, sec] = section;
-        txtfout << name << " " << sec.data.size() << endl;
-    }
-    for(auto section : combined_sections)
-    {
-        auto& [name, sec] = section;
-        txtfout << "." << name << endl;
-        int i = 0;
-        
-        for(char c : sec.data)
+void write_string(ofstream& fout, const string& str)
+{
+    write_u32(fout, str.size());
+    fout.write(str.c_str(), str.size());
+}
+
+constexpr char link_cache_magic[4] = {'S', 'S', 'L', '2'}; // 2: sections carry their zero-fill size
+
+void save_link_cache(const string& file_name, const LinkCache& cache)
+{
+    ofstream fout(file_name, ios::binary);
+    fout.write(link_cache_magic, sizeof(link_cache_magic));
+    write_string(fout, cache.options);
+    auto write_sections = [&](const vector<CachedSection>& sections) {
+        write_u32(fout, sections.size());
+        for(auto& sec : sections)
         {
-            if(i % 16 == 0)
-                txtfout << endl;
-            
-            txtfout << format("{:02X} ", c);
-            
-            i++;
+            write_string(fout, sec.name);
+            write_u32(fout, sec.address);
+            write_u32(fout, sec.size);
+            write_u32(fout, sec.bss);
         }
-    }
-    txtfout << endl;
-    txtfout << dec;
-
-    for(auto section : combined_sections)
-    {
-        auto& [name, sec] = section;
-        txtfout << "." << name << ".rel" << endl;
-        for(auto& rel : sec.rel)
+    };
+    auto write_values = [&](const vector<CachedValue>& values) {
+        write_u32(fout, values.size());
+        for(auto& value : values)
         {
-            txtfout << rel.offset << " " << rel.symbol << " " << rel.addend << endl;
+            write_string(fout, value.name);
+            write_u32(fout, value.value);
         }
-    }
-    txtfout << "Symbols:" << combined_symbols.size() << endl;
-    for(auto symbol : combined_symbols)
+    };
+    write_u32(fout, cache.inputs.size());
+    for(auto& input : cache.inputs)
     {
-        auto& [name, sym] = symbol;
-        char type = 'g';
-        if(not sym.resolved)
-            type = 'e';
-        txtfout << name << " " << sym.value << " " << sym.section << " " << type << endl;
+        write_string(fout, input.path);
+        write_u32(fout, input.hash);
+        write_u32(fout, input.hash >> 32);
+        fout.put(input.is_archive);
+        write_u32(fout, input.signature);
+        write_u32(fout, input.signature >> 32);
+        write_sections(input.sections);
+        write_values(input.section_adjusts);
     }
-    txtfout.close();
+    write_values(cache.symbols);
+    write_sections(cache.sections);
+}
 
-    ofstream fout(file_name, ios::binary);
-    u32 num_sections = combined_sections.size();
-    fout.write((char*)&num_sections, sizeof(num_sections));
-    // name length, name, data size, data
-    for(auto section : combined_sections)
-    {
-        auto& [name, sec] = section;
-        u32 name_len = name.size();
-        fout.write((char*)&name_len, sizeof(name_len));
-        fout.write(name.c_str(), name_len);
-        u32 data_size = sec.data.size();
-        fout.write((char*)&data_size, sizeof(data_size));
-        fout.write(sec.data.data(), data_size);
+bool load_link_cache(const string& file_name, LinkCache& cache)
+{
+    ifstream file(file_name, ios::binary);
+    if(not file)
+        return false;
+    string content(istreambuf_iterator<char>(file), {});
+    if(content.size() < sizeof(link_cache_magic) or memcmp(content.data(), link_cache_magic, sizeof(link_cache_magic)))
+        return false;
+    ObjectReader in{content.data() + sizeof(link_cache_magic), content.data() + content.size(), file_name};
+    auto read_sections = [&]() {
+        vector<CachedSection> sections(in.read_u32());
+        for(auto& sec : sections)
+        {
+            sec.name = in.read_name();
+            sec.address = in.read_u32();
+            sec.size = in.read_u32();
+            sec.bss = in.read_u32();
+        }
+        return sections;
+    };
+    auto read_values = [&]() {
+        vector<CachedValue> values(in.read_u32());
+        for(auto& value : values)
+        {
+            value.name = in.read_name();
+            value.value = in.read_u32();
+        }
+        return values;
+    };
+    try {
+        cache.options = in.read_name();
+        cache.inputs.resize(in.read_u32());
+        for(auto& input : cache.inputs)
+        {
+            input.path = in.read_name();
+            input.hash = in.read_u64();
+            input.is_archive = in.read_char();
+            input.signature = in.read_u64();
+            input.sections = read_sections();
+            input.section_adjusts = read_values();
+        }
+        cache.symbols = read_values();
+        cache.sections = read_sections();
+    } catch(runtime_error&) {
+        return false; // a damaged cache only costs a full link
     }
-    for(auto section : combined_sections)
+    return true;
+}
+
+LinkCache build_link_cache(const string& options, const vector<string>& filenames)
+{
+    LinkCache cache;
+    cache.options = options;
+    for(size_t i = 0; i < input_files.size(); i++)
     {
-        auto& [name, sec] = section;
-        u32 num_relocations = sec.rel.size();
-        fout.write((char*)&num_relocations, sizeof(num_relocations));
-        for(auto& rel : sec.rel)
+        auto& input = input_files[i];
+        CachedInput cached{filenames[i], input.hash, input.is_archive, 0, {}, {}};
+        if(not input.is_archive)
         {
-            u32 offset = rel.offset;
-            fout.write((char*)&offset, sizeof(offset));
-            u32 addend = rel.addend;
-            fout.write((char*)&addend, sizeof(addend));
-            u32 symbol_len = rel.symbol.size();
-            fout.write((char*)&symbol_len, sizeof(symbol_len));
-            fout.write(rel.symbol.c_str(), symbol_len);
+            auto& obj = input.obj;
+            cached.signature = input.signature;
+            for(size_t s = 0; s < obj.sections.size(); s++)
+            {
+                auto& sec = obj.sections[s];
+                u32 idx = section_index[sec.name];
+                u32 address = idx == none ? none : section_offsets[idx] + obj.chunk_offsets[s]; // none if garbage collected
+                cached.sections.push_back(CachedSection{names[sec.name], address, section_size(sec), sec.bss});
+            }
+            for(auto& [name, adjust] : obj.section_adjusts)
+                cached.section_adjusts.push_back(CachedValue{names[name], adjust});
         }
+        cache.inputs.push_back(std::move(cached));
     }
-
-    u32 num_symbols = combined_symbols.size();
-    fout.write((char*)&num_symbols, sizeof(num_symbols));
-    // name length, name, value, section
-    for(auto symbol : combined_symbols)
+    for(auto& sym : combined_symbols)
     {
-        auto& [name, sym] = symbol;
-        u32 name_len = name.size();
-        fout.write((char*)&name_len, sizeof(name_len));
-        fout.write(name.c_str(), name_len);
-        fout.write((char*)&sym.value, sizeof(sym.value));
-        u32 section_len = sym.section.size();
-        fout.write((char*)&section_len, sizeof(section_len));
-        fout.write(sym.section.c_str(), section_len);
-        char type = 'g';
         if(not sym.resolved)
-            type = 'e';
-        fout.write(&type, 1);
+            continue;
+        u32 sec_idx = section_index[sym.section];
+        cache.symbols.push_back(CachedValue{names[sym.name], sym.value + (sec_idx == none ? 0 : section_offsets[sec_idx])});
     }
-    fout.close();
+    for(u32 idx = 0; idx < combined_sections.size(); idx++)
+    {
+        auto& sec = combined_sections[idx];
+        cache.sections.push_back(CachedSection{names[sec.name], section_offsets[idx], section_size(sec), sec.bss});
+    }
+    stable_sort(cache.sections.begin(), cache.sections.end(), [](const CachedSection& a, const CachedSection& b) {
+        return a.address < b.address;
+    });
+    return cache;
 }
 
-void dump_hex(const string& file_name, const vector<Placement>& placements)
+// patches the objects that changed since the cached link into the existing output,
+// returns false if a full link is needed
+bool incremental_link(const string& cache_file, const string& out_filename, const string& options, const vector<string>& filenames)
 {
-    unordered_map<string, u32> section_offsets;
-    unordered_set<string> placed_sections;
-    // preallocate 4Gb
-    vector<char> data(4ull*1024*1024*1024);
-
-    // first place sections in placements
-    // keep track of the last section end
-    u64 current_pos = 0;
-    string last_placed_section;
-    for(auto& placement : placements)
-    {
-        if(current_pos > placement.start)
-        {
-            err_str = "Sekcije " + last_placed_section + " i " + placement.name + " se preklapaju zbog -place direktiva";
-            throw runtime_error(err_str);
-        }
+    LinkCache cache;
+    if(not load_link_cache(cache_file, cache) or cache.options != options or cache.inputs.size() != filenames.size())
+        return false;
+    if(not filesystem::exists(out_filename))
+        return false;
 
+    unordered_map<string, u32> symbol_addresses;
+    for(auto& [name, address] : cache.symbols)
+        symbol_addresses[name] = address;
 
-        section_offsets[placement.name] = placement.start;
-        current_pos = placement.start;
-        // write the section data
-        auto& sec = combined_sections[placement.name];
-        copy(sec.data.begin(), sec.data.end(), data.begin() + current_pos);
-        current_pos += sec.data.size();
-        last_placed_section = placement.name;
-        placed_sections.insert(placement.name);
-    }
-    // then place the rest of the sections
-    for(auto& section : combined_sections)
+    struct Patch
     {
-        auto& [name, sec] = section;
-        if(placed_sections.contains(name))
-            continue;
-        
-        section_offsets[name] = current_pos;
-        copy(sec.data.begin(), sec.data.end(), data.begin() + current_pos);
-        current_pos += sec.data.size();
-    }
-    
-    // then resolve relocations
-    for(auto& section : combined_sections)
+        u32 address;
+        vector<char> data;
+    };
+    vector<Patch> patches;
+    for(size_t i = 0; i < filenames.size(); i++)
     {
-        // TODO: double check this
-        auto& [name, sec] = section;
-        for(auto& rel : sec.rel)
+        auto& cached = cache.inputs[i];
+        if(cached.path != filenames[i])
+            return false;
+        auto [data, size] = map_file(filenames[i]);
+        u64 hash = fnv1a(data, size);
+        if(hash == cached.hash)
+        {
+            munmap((void*)data, size);
+            continue;
+        }
+        // a changed archive may pull in different members
+        if(cached.is_archive or is_archive(data, size))
         {
-            // a relocation
-            // in a section
-            // means that at section location + offset
-            // you write symbol value + addend
-            // where the real symbol value is symbol value + symbol_section offset(0 if not in a section)
+            munmap((void*)data, size);
+            return false;
+        }
+        ObjectFile obj = parse_object(data, size, filenames[i]);
+        munmap((void*)data, size);
+        if(object_signature(obj) != cached.signature or obj.sections.size() != cached.sections.size())
+            return false;
 
-            if(combined_sections.find(rel.symbol) != combined_sections.end())
-            {
-                u32 value = section_offsets[rel.symbol] + rel.addend;
-                u32 offset = section_offsets[name] + rel.offset;
-                *(u32*)(data.data() + offset) = value;
-            }
-            else
+        for(size_t s = 0; s < obj.sections.size(); s++)
+        {
+            auto& sec = obj.sections[s];
+            if(cached.sections[s].address == none)
+                return false; // was garbage collected, its references may have changed
+            Patch patch{cached.sections[s].address, std::move(sec.data)};
+            for(auto& rel : sec.rel)
             {
-                Symbol& symbol = combined_symbols[rel.symbol];
-                if(not symbol.resolved and not rel.symbol.empty())
+                auto& target = obj.names[rel.symbol];
+                u32 value = rel.addend;
+                if(rel.symbol != 0) // not absolute
                 {
-                    err_str = "Simbol " + rel.symbol + " nije definisan";
-                    throw runtime_error(err_str);
+                    auto adjust = find_if(cached.section_adjusts.begin(), cached.section_adjusts.end(), [&](const CachedValue& v) {
+                        return v.name == target;
+                    });
+                    auto section = find_if(cache.sections.begin(), cache.sections.end(), [&](const CachedSection& s) {
+                        return s.name == target;
+                    });
+                    if(adjust != cached.section_adjusts.end() and section != cache.sections.end())
+                        value += section->address + adjust->value;
+                    else if(symbol_addresses.contains(target))
+                        value += symbol_addresses[target];
+                    else
+                        return false; // a new section reference or an undefined symbol, let the full link handle it
                 }
-                u32 sec_offset = section_offsets[symbol.section];
-                u32 value = symbol.value + rel.addend + sec_offset;
-                u32 offset = section_offsets[name] + rel.offset;
-                *(u32*)(data.data() + offset) = value;
+
+                if((u64)rel.offset + 4 > patch.data.size())
+                    return false;
+                memcpy(patch.data.data() + rel.offset, &value, sizeof(value));
             }
+            patches.push_back(std::move(patch));
         }
+        cached.hash = hash;
     }
 
-    
-    ofstream txtfout(file_name + ".txt");
-    // When dumping the text representation, dump only memory that is a part of a section
-    // format: Section: name start: start length: length then hex data
-
-    // first, sort all section offsets
-    vector<pair<string, u32>> sorted_offsets(section_offsets.begin(), section_offsets.end());
-    sort(sorted_offsets.begin(), sorted_offsets.end(), [](const pair<string, u32>& a, const pair<string, u32>& b) {
-        return a.second < b.second;
-    });
-
-    for(auto& [name, start] : sorted_offsets)
+    fstream fout(out_filename, ios::in | ios::out | ios::binary);
+    for(auto& patch : patches)
     {
-        auto& sec = combined_sections[name];
-        txtfout << "Section: " << name << " start: " << start << " length: " << sec.data.size() << endl;
-        int i = 0;
-        const auto offf = section_offsets[name];
-        for(int i = 0; i < sec.data.size(); i++)
-        {
-            if(i % 16 == 0)
-                txtfout << endl;
-            
-            txtfout << format("{:02X} ", data[i + offf]);
-        }
-        txtfout << endl;
+        fout.seekp(patch.address);
+        fout.write(patch.data.data(), patch.data.size());
     }
 
-    txtfout.close();
-
-    ofstream fout(file_name, ios::binary);
-    // for the hex file dump all 4Gb of data
-    fout.write(data.data(), data.size());
-
+    // the listing and the build id are rebuilt from the patched image
+    ofstream txtfout;
+    if(listing)
+        txtfout.open(out_filename + ".txt");
+    else
+        filesystem::remove(out_filename + ".txt");
+    u64 build_id = fnv1a(nullptr, 0);
+    vector<char> data;
+    for(auto& sec : cache.sections)
+    {
+        data.assign(sec.size - sec.bss, 0);
+        fout.seekg(sec.address);
+        fout.read(data.data(), data.size());
+        fout.clear(); // a section at the end of a sparse file may read short
+        if(listing)
+            write_section_listing(txtfout, sec.name, sec.address, data.data(), data.size(), sec.bss);
+        if(sec.size)
+            build_id = hash_image_section(build_id, sec.address, sec.size, data.data(), data.size());
+    }
     fout.close();
+    write_build_id(out_filename, build_id);
+
+    save_link_cache(cache_file, cache);
+    return true;
 }
 
 int main(int argc, char** argv)
@@ -424,6 +2213,14 @@ int main(int argc, char** argv)
     vector<Placement> placements;
     bool hex = false;
     bool relocatable = false;
+    bool archive = false;
+    u32 num_threads = 1;
+    string cache_file;
+    string order_file;
+    bool gc = false;
+    bool relaxation = false;
+    vector<string> icf_sections;
+    vector<string> keep_symbols;
     for(int i = 1; i < argc; i++)
     {
         if(argv[i] == "-o"sv)
@@ -444,6 +2241,54 @@ int main(int argc, char** argv)
             relocatable = true;
             continue;
         }
+        if(argv[i] == "-archive"sv)
+        {
+            archive = true;
+            continue;
+        }
+        if(argv[i] == "-no-listing"sv)
+        {
+            listing = false;
+            continue;
+        }
+        if(argv[i] == "-time-report"sv)
+        {
+            time_report = true;
+            continue;
+        }
+        if(argv[i] == "-relax"sv)
+        {
+            relaxation = true;
+            continue;
+        }
+        if(argv[i] == "-gc-sections"sv)
+        {
+            gc = true;
+            continue;
+        }
+        if (std::string_view(argv[i]).starts_with("-order=")) {
+            order_file = string(argv[i] + 7);
+            continue;
+        }
+        if (std::string_view(argv[i]).starts_with("-icf=")) {
+            icf_sections.push_back(string(argv[i] + 5));
+            continue;
+        }
+        if (std::string_view(argv[i]).starts_with("-keep=")) {
+            keep_symbols.push_back(string(argv[i] + 6));
+            continue;
+        }
+        if (std::string_view(argv[i]).starts_with("-link-cache=")) {
+            cache_file = string(argv[i] + 12);
+            continue;
+        }
+        if (std::string_view(argv[i]).starts_with("-threads=")) {
+            // 0 uses all hardware threads
+            num_threads = stoul(string(argv[i] + 9), 0, 0);
+            if (num_threads == 0)
+                num_threads = max(thread::hardware_concurrency(), 1u);
+            continue;
+        }
         if (std::string_view(argv[i]).starts_with("-place")) {
             // -place=name@start
             std::string_view place = argv[i] + 7;
@@ -465,21 +2310,57 @@ int main(int argc, char** argv)
         cout << "Nema ulaznih fajlova" << endl;
         return 1;
     }
-    if(hex and relocatable)
+    if(hex + relocatable + archive > 1)
+    {
+        cout << "Ne moze se koristiti vise od jednog od -hex, -relocatable i -archive zajedno" << endl;
+        return 1;
+    }
+    if((not hex) and (not relocatable) and (not archive))
+    {
+        cout << "Mora se koristiti -hex, -relocatable ili -archive" << endl;
+        return 1;
+    }
+    if((not hex) and placements.size() > 0)
+    {
+        cout << "-place direktive navedene van -hex moda" << endl;
+        return 1;
+    }
+    if((not hex) and gc)
+    {
+        cout << "-gc-sections naveden van -hex moda" << endl;
+        return 1;
+    }
+    if((not hex) and not order_file.empty())
+    {
+        cout << "-order naveden van -hex moda" << endl;
+        return 1;
+    }
+    if((not hex) and not icf_sections.empty())
     {
-        cout << "Ne moze se koristiti -hex i -relocatable zajedno" << endl;
+        cout << "-icf naveden van -hex moda" << endl;
         return 1;
     }
-    if((not hex) and (not relocatable))
+    if((not hex) and relaxation)
     {
-        cout << "Mora se koristiti -hex ili -relocatable" << endl;
+        cout << "-relax naveden van -hex moda" << endl;
         return 1;
     }
-    if(relocatable and placements.size() > 0)
+    if(relaxation and not cache_file.empty())
     {
-        cout << "-place direktive navedene u -relocatable modu" << endl;
+        cout << "-relax i -link-cache se ne mogu koristiti zajedno" << endl;
         return 1;
     }
+    // a folded section reads the survivor's bytes, patching a changed survivor in place would change it too
+    if(not icf_sections.empty() and not cache_file.empty())
+    {
+        cout << "-icf i -link-cache se ne mogu koristiti zajedno" << endl;
+        return 1;
+    }
+    if(archive)
+    {
+        dump_archive(out_filename, object_files);
+        return 0;
+    }
 
     if (placements.size() > 0) {
         std::sort(placements.begin(), placements.end(), [](const Placement& a, const Placement& b) {
@@ -487,19 +2368,83 @@ int main(int argc, char** argv)
         });
     }
 
-    for(auto& file : object_files)
+    // everything besides the inputs that influences a -hex link
+    string cache_options;
+    for(auto& placement : placements)
+        cache_options += placement.name + "@" + to_string(placement.start) + ";";
+    if(gc)
+    {
+        cache_options += "gc;";
+        for(auto& name : keep_symbols)
+            cache_options += "keep=" + name + ";";
+    }
+    for(auto& name : icf_sections)
+        cache_options += "icf=" + name + ";";
+    vector<string> order;
+    if(not order_file.empty())
+    {
+        order = read_order_file(order_file);
+        cache_options += "order=";
+        for(auto& name : order)
+            cache_options += name + ",";
+        cache_options += ";";
+    }
+    link_cache_enabled = hex and not cache_file.empty();
+    phase_start = chrono::steady_clock::now();
+    phase_allocated = allocated_bytes.load();
+    if(link_cache_enabled and incremental_link(cache_file, out_filename, cache_options, object_files))
+    {
+        end_phase("inkrementalno");
+        print_time_report();
+        return 0;
+    }
+
+    read_objects(object_files, num_threads);
+    end_phase("citanje");
+    // archive members are only pulled in for symbols undefined at the archive's position
+    for(size_t i = 0; i < input_files.size(); i++)
     {
-        auto& obj = read_object(file);
-        process_object(obj);
+        if(input_files[i].is_archive)
+            load_archive_members(input_files[i].archive, object_files[i]);
+        else
+            process_object(input_files[i].obj);
     }
+    end_phase("spajanje");
     if(relocatable)
     {
-        dump_relocatable(out_filename);
+        dump_relocatable(out_filename, num_threads);
     }
     else
     {
-        dump_hex(out_filename, placements);
+        if(gc)
+        {
+            auto removed = gc_sections(placements, keep_symbols);
+            erase_if(placements, [&](const Placement& p) { return removed.contains(p.name); });
+            end_phase("gc");
+        }
+        if(not icf_sections.empty())
+        {
+            fold_identical_sections(placements, icf_sections);
+            end_phase("icf");
+        }
+        if(relaxation)
+        {
+            relax();
+            end_phase("relaksacija");
+        }
+        if(not order_file.empty())
+        {
+            order_sections(order);
+            end_phase("redosled");
+        }
+        dump_hex(out_filename, placements, num_threads);
+        if(link_cache_enabled)
+        {
+            save_link_cache(cache_file, build_link_cache(cache_options, object_files));
+            end_phase("kes");
+        }
     }
+    print_time_report();
     
     
 }
\ No newline at end of file